@@ -0,0 +1,315 @@
+/**
+ * @file aesd-circular-buffer-spmc.c
+ * @brief Lock-free single producer / multiple consumer circular buffer for user space
+ *
+ * Same idea as aesd-circular-buffer.c (most recent write commands, looked up by char offset), but safe to
+ * read from any number of threads while one thread adds entries, without a mutex.  The producer publishes
+ * with release stores and consumers validate what they copied against per-slot sequence numbers and the
+ * arena's reserved offset, retrying or failing instead of waiting.
+ *
+ * Ref: [1] https://en.cppreference.com/w/c/atomic/memory_order
+ *      [2] H. Boehm, "Can Seqlocks Get Along With Programming Language Memory Models?", MSPC 2012
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd-circular-buffer-spmc.h"
+
+/**
+ * Initializes @param ring to hold up to @param capacity entries and @param data_size bytes of entry data
+ * @return 0 on success, -1 on invalid arguments or allocation failure
+ */
+int aesd_spmc_ring_init(struct aesd_spmc_ring *ring, unsigned int capacity, size_t data_size)
+{
+    unsigned int index;
+
+    if (ring == NULL || capacity == 0 || data_size == 0)
+        return -1;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->slot = calloc(capacity, sizeof(struct aesd_spmc_slot));
+    ring->data = malloc(data_size);
+    if (ring->slot == NULL || ring->data == NULL)
+    {
+        aesd_spmc_ring_destroy(ring);
+        return -1;
+    }
+
+    for (index = 0; index < capacity; index++)
+    {
+        atomic_init(&ring->slot[index].seq, 0);
+        atomic_init(&ring->slot[index].start, 0);
+        atomic_init(&ring->slot[index].size, 0);
+    }
+    ring->capacity = capacity;
+    ring->data_size = data_size;
+    atomic_init(&ring->in_offs, 0);
+    atomic_init(&ring->out_offs, 0);
+    atomic_init(&ring->total_added, 0);
+    atomic_init(&ring->reserved, 0);
+    return 0;
+}
+
+/**
+ * Frees the memory of @param ring.  No thread may use it any more.
+ */
+void aesd_spmc_ring_destroy(struct aesd_spmc_ring *ring)
+{
+    if (ring == NULL)
+        return;
+
+    free(ring->slot);
+    free((void *)ring->data);
+    ring->slot = NULL;
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->data_size = 0;
+}
+
+/**
+ * Reads start and size of entry @param entry_number from its slot
+ * @return false if the slot does not hold that entry, or was rewritten while being read
+ */
+static bool read_slot(struct aesd_spmc_ring *ring, uint64_t entry_number, uint64_t *start, uint64_t *size)
+{
+    struct aesd_spmc_slot *slot = &ring->slot[entry_number % ring->capacity];
+    uint64_t expected = 2 * (entry_number + 1);
+
+    // Ref: [2] seqlock reader: acquire load of seq, relaxed loads of the data, acquire fence, reload seq
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != expected)
+        return false;
+    *start = atomic_load_explicit(&slot->start, memory_order_relaxed);
+    *size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == expected;
+}
+
+/**
+ * Copies @param len bytes starting at stream offset @param pos out of the arena, wrapping at its end.
+ *
+ * The producer may be rewriting these bytes at the same time; the caller detects that afterwards and throws
+ * the copy away.  The race is intended, so both sides use relaxed atomic byte accesses instead of memcpy: a
+ * plain copy would be a data race (undefined behaviour in C11, and reported by ThreadSanitizer).
+ */
+static void copy_from_arena(const struct aesd_spmc_ring *ring, uint64_t pos, char *dest, size_t len)
+{
+    size_t offset = pos % ring->data_size;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        dest[i] = atomic_load_explicit(&ring->data[offset], memory_order_relaxed);
+        if (++offset == ring->data_size)
+            offset = 0;
+    }
+}
+
+/**
+ * Copies @param len bytes from @param src into the arena at stream offset @param pos, wrapping at its end.
+ * Producer only; see copy_from_arena() for why the bytes are stored atomically.
+ */
+static void copy_to_arena(struct aesd_spmc_ring *ring, uint64_t pos, const char *src, size_t len)
+{
+    size_t offset = pos % ring->data_size;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        atomic_store_explicit(&ring->data[offset], src[i], memory_order_relaxed);
+        if (++offset == ring->data_size)
+            offset = 0;
+    }
+}
+
+/**
+ * Adds a copy of @param size bytes at @param buffptr to @param ring as its newest entry, dropping the oldest
+ * entries when all slots are used or their bytes would be overwritten.  Producer thread only.
+ * @return 0 on success, -1 if the entry is larger than the data arena
+ */
+int aesd_spmc_ring_add_entry(struct aesd_spmc_ring *ring, const char *buffptr, size_t size)
+{
+    uint64_t in, out, total, start;
+    struct aesd_spmc_slot *slot;
+
+    if (ring == NULL || (buffptr == NULL && size != 0) || size > ring->data_size)
+        return -1;
+
+    // Only this thread writes in_offs, out_offs and total_added, so relaxed loads see its own last stores
+    in = atomic_load_explicit(&ring->in_offs, memory_order_relaxed);
+    out = atomic_load_explicit(&ring->out_offs, memory_order_relaxed);
+    total = atomic_load_explicit(&ring->total_added, memory_order_relaxed);
+
+    // Drop entries that lose their slot or whose bytes the new entry overwrites
+    if (in - out == ring->capacity)
+        out++;
+    while (out < in)
+    {
+        start = atomic_load_explicit(&ring->slot[out % ring->capacity].start, memory_order_relaxed);
+        if (total + size - start <= ring->data_size)
+            break;
+        out++;
+    }
+    atomic_store_explicit(&ring->out_offs, out, memory_order_relaxed);
+    atomic_store_explicit(&ring->reserved, total + size, memory_order_relaxed);
+
+    // Mark the slot as being rewritten, then make sure the new out_offs, reserved and odd seq are visible
+    // before any byte of the arena or slot changes
+    slot = &ring->slot[in % ring->capacity];
+    atomic_store_explicit(&slot->seq, 2 * in + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    copy_to_arena(ring, total, buffptr, size);
+
+    atomic_store_explicit(&slot->start, total, memory_order_relaxed);
+    atomic_store_explicit(&slot->size, size, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, 2 * (in + 1), memory_order_release);
+
+    // Publish: a consumer that sees the new in_offs (acquire) sees the complete entry
+    atomic_store_explicit(&ring->total_added, total + size, memory_order_release);
+    atomic_store_explicit(&ring->in_offs, in + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Fills @param view with the entries and byte range of @param ring at one point in time
+ * @return false if the ring is empty
+ */
+bool aesd_spmc_ring_snapshot(struct aesd_spmc_ring *ring, struct aesd_spmc_view *view)
+{
+    uint64_t in, out, start, size, last_start, last_size;
+
+    if (ring == NULL || view == NULL)
+        return false;
+
+    for (;;)
+    {
+        in = atomic_load_explicit(&ring->in_offs, memory_order_acquire);
+        out = atomic_load_explicit(&ring->out_offs, memory_order_acquire);
+        if (out >= in)
+        {
+            // Either empty, or entries were added between the two loads
+            if (atomic_load_explicit(&ring->in_offs, memory_order_acquire) == in)
+                return false;
+            continue;
+        }
+
+        // Both ends must still hold the entries we think they do; otherwise the producer moved on, retry
+        if (!read_slot(ring, out, &start, &size) || !read_slot(ring, in - 1, &last_start, &last_size))
+            continue;
+
+        view->first = out;
+        view->count = in - out;
+        view->start = start;
+        view->end = last_start + last_size;
+        return true;
+    }
+}
+
+/**
+ * Looks up entry @param entry_number of @param ring
+ * @return false if the entry was dropped already or has not been added yet
+ */
+bool aesd_spmc_ring_get_entry(struct aesd_spmc_ring *ring, uint64_t entry_number,
+            uint64_t *start_rtn, size_t *size_rtn)
+{
+    uint64_t start, size;
+
+    if (ring == NULL || entry_number >= atomic_load_explicit(&ring->in_offs, memory_order_acquire))
+        return false;
+    if (entry_number < atomic_load_explicit(&ring->out_offs, memory_order_acquire))
+        return false;
+    if (!read_slot(ring, entry_number, &start, &size))
+        return false;
+
+    if (start_rtn != NULL)
+        *start_rtn = start;
+    if (size_rtn != NULL)
+        *size_rtn = size;
+    return true;
+}
+
+/**
+ * Same as aesd_circular_buffer_find_entry_offset_for_fpos: @param char_offset counts from the oldest byte
+ * stored when the call is made.  Returns the number of the entry holding that byte in
+ * @param entry_number_rtn and the byte's offset within it in @param entry_offset_byte_rtn.
+ * @return false if @param char_offset is at or past the end of the stored data
+ */
+bool aesd_spmc_ring_find_entry_offset_for_fpos(struct aesd_spmc_ring *ring, size_t char_offset,
+            uint64_t *entry_number_rtn, size_t *entry_offset_byte_rtn)
+{
+    struct aesd_spmc_view view;
+    uint64_t low, high, mid, target, start, size;
+    bool retry;
+
+    if (ring == NULL || entry_number_rtn == NULL || entry_offset_byte_rtn == NULL)
+        return false;
+
+    do
+    {
+        if (!aesd_spmc_ring_snapshot(ring, &view))
+            return false;
+
+        target = view.start + char_offset;
+        if (target >= view.end)
+            return false;
+
+        // Newest entry starting at or before target; zero length entries share their start with the next one
+        low = view.first;
+        high = view.first + view.count;
+        retry = false;
+        while (high - low > 1)
+        {
+            mid = low + (high - low) / 2;
+            if (!read_slot(ring, mid, &start, &size))
+            {
+                retry = true;
+                break;
+            }
+            if (start <= target)
+                low = mid;
+            else
+                high = mid;
+        }
+        if (!retry && !read_slot(ring, low, &start, &size))
+            retry = true;
+    } while (retry);
+
+    *entry_number_rtn = low;
+    *entry_offset_byte_rtn = target - start;
+    return true;
+}
+
+/**
+ * Copies up to @param len bytes from stream offset @param pos of @param ring into @param dest, across entries
+ * @return bytes copied, 0 at the end of the data, or -1 if @param pos is older than the oldest entry or was
+ * overwritten during the copy; the caller restarts from aesd_spmc_ring_snapshot()'s start
+ */
+ssize_t aesd_spmc_ring_read(struct aesd_spmc_ring *ring, uint64_t pos, char *dest, size_t len)
+{
+    struct aesd_spmc_view view;
+    uint64_t reserved;
+
+    if (ring == NULL || (dest == NULL && len != 0))
+        return -1;
+
+    if (!aesd_spmc_ring_snapshot(ring, &view))
+        return 0;
+    if (pos < view.start)
+        return -1;
+    if (pos >= view.end)
+        return 0;
+
+    if (len > view.end - pos)
+        len = view.end - pos;
+    copy_from_arena(ring, pos, dest, len);
+
+    // Ref: [2] The copy is only good if the producer had not reserved the arena past pos + data_size by the
+    // time it finished
+    atomic_thread_fence(memory_order_acquire);
+    reserved = atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+    if (reserved > pos + ring->data_size)
+        return -1;
+
+    return len;
+}
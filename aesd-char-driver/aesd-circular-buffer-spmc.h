@@ -0,0 +1,105 @@
+/*
+ * aesd-circular-buffer-spmc.h
+ *
+ *  User space, lock-free variant of aesd-circular-buffer for one producer and any number of consumers.
+ *
+ *  Unlike struct aesd_circular_buffer, the ring owns the bytes of its entries: they are copied into a data
+ *  arena, so a consumer never follows a pointer the producer may have freed.  Entries are numbered from 0 in
+ *  the order they were added, and every byte has a stream offset, its position in the stream of every byte
+ *  ever added.  Entry n lives in slot n % capacity; the slot's sequence number is odd while the producer
+ *  rewrites it and 2 * (n + 1) once it holds entry n, so consumers detect entries replaced under them.
+ *
+ *  The oldest entries are dropped when the slots are full or when the bytes would no longer fit the arena.
+ *  Consumers never block the producer: a consumer that falls behind gets a failure and starts again from the
+ *  current oldest entry.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_SPMC_H
+#define AESD_CIRCULAR_BUFFER_SPMC_H
+
+#ifdef __KERNEL__
+#error "aesd-circular-buffer-spmc is user space only; the driver uses aesd-circular-buffer with dev->lock"
+#endif
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h> // ssize_t
+
+struct aesd_spmc_slot
+{
+    /**
+     * 2 * (n + 1) when the slot holds entry n, odd while the producer rewrites it
+     */
+    _Atomic uint64_t seq;
+    /**
+     * Stream offset of the first byte of the entry
+     */
+    _Atomic uint64_t start;
+    /**
+     * Number of bytes in the entry
+     */
+    _Atomic uint64_t size;
+};
+
+struct aesd_spmc_ring
+{
+    /**
+     * capacity slots, allocated by aesd_spmc_ring_init
+     */
+    struct aesd_spmc_slot *slot;
+    unsigned int capacity;
+    /**
+     * Data arena of data_size bytes; the byte at stream offset p is stored at data[p % data_size].
+     * Atomic because consumers may read bytes the producer is overwriting, and discard them afterwards.
+     */
+    _Atomic char *data;
+    size_t data_size;
+    /**
+     * Number of entries ever added; the next entry goes to slot in_offs % capacity.  Written by the producer only.
+     */
+    _Atomic uint64_t in_offs;
+    /**
+     * Number of the oldest entry still stored.  Written by the producer only.
+     */
+    _Atomic uint64_t out_offs;
+    /**
+     * Stream offset one past the newest complete entry
+     */
+    _Atomic uint64_t total_added;
+    /**
+     * Stream offset up to which the producer may have started writing the arena.  Bytes before
+     * reserved - data_size may have been overwritten.
+     */
+    _Atomic uint64_t reserved;
+};
+
+/**
+ * A consistent view of the ring, taken with aesd_spmc_ring_snapshot
+ */
+struct aesd_spmc_view
+{
+    uint64_t first;       // Number of the oldest entry
+    uint64_t count;       // Number of entries, first .. first + count - 1
+    uint64_t start;       // Stream offset of the oldest byte
+    uint64_t end;         // Stream offset one past the newest byte
+};
+
+extern int aesd_spmc_ring_init(struct aesd_spmc_ring *ring, unsigned int capacity, size_t data_size);
+
+extern void aesd_spmc_ring_destroy(struct aesd_spmc_ring *ring);
+
+extern int aesd_spmc_ring_add_entry(struct aesd_spmc_ring *ring, const char *buffptr, size_t size);
+
+extern bool aesd_spmc_ring_snapshot(struct aesd_spmc_ring *ring, struct aesd_spmc_view *view);
+
+extern bool aesd_spmc_ring_get_entry(struct aesd_spmc_ring *ring, uint64_t entry_number,
+            uint64_t *start_rtn, size_t *size_rtn);
+
+extern bool aesd_spmc_ring_find_entry_offset_for_fpos(struct aesd_spmc_ring *ring, size_t char_offset,
+            uint64_t *entry_number_rtn, size_t *entry_offset_byte_rtn);
+
+extern ssize_t aesd_spmc_ring_read(struct aesd_spmc_ring *ring, uint64_t pos, char *dest, size_t len);
+
+#endif /* AESD_CIRCULAR_BUFFER_SPMC_H */
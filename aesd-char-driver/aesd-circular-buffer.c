@@ -16,6 +16,53 @@
 
 #include "aesd-circular-buffer.h"
 
+/**
+ * @param buffer the buffer to query.  Any necessary locking must be performed by caller.
+ * @return the number of entries currently stored in @param buffer
+ */
+size_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return buffer->capacity;
+
+    return (buffer->in_offs + buffer->capacity - buffer->out_offs) % buffer->capacity;
+}
+
+/**
+ * @param buffer the buffer to query.  Any necessary locking must be performed by caller.
+ * @return the total number of bytes stored in @param buffer, i.e. the length of all entries concatenated.
+ * O(1): the running total minus the stream offset of the oldest entry.
+ */
+size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    if (aesd_circular_buffer_count(buffer) == 0)
+        return 0;
+
+    return buffer->total_added - buffer->entry[buffer->out_offs].start;
+}
+
+/**
+ * @param buffer the buffer to look in.  Any necessary locking must be performed by caller.
+ * @param entry_index zero referenced index of the entry, 0 being the oldest entry in the buffer
+ * @param char_offset_rtn if not NULL, set to the char offset of the first byte of the entry, in the
+ *      same coordinates as aesd_circular_buffer_find_entry_offset_for_fpos
+ * @return the entry, or NULL if fewer than @param entry_index + 1 entries are stored
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *char_offset_rtn)
+{
+    unsigned int index;
+
+    if (buffer == NULL || entry_index >= aesd_circular_buffer_count(buffer))
+        return NULL;
+
+    index = (buffer->out_offs + entry_index) % buffer->capacity;
+    if (char_offset_rtn != NULL)
+        *char_offset_rtn = buffer->entry[index].start - buffer->entry[buffer->out_offs].start;
+
+    return &(buffer->entry[index]);
+}
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -25,17 +72,21 @@
  *      in aesd_buffer.
  * @return the struct aesd_buffer_entry structure representing the position described by char_offset, or
  * NULL if this position is not available in the buffer (not enough data is written).
+ *
+ * Binary search over the entries' start prefix sums, O(log n) in the number of stored entries.
  */
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    uint8_t out_offs = 0;
-    
-        // Variable to loop through buffer
-    uint8_t entry_num = 0;
-    
-    // Var to store total offset
-    size_t total_offset = 0;
+    // Stream offset of the requested byte
+    uint64_t target;
+
+    // Search window over entries, 0 being the oldest; invariant: the entry holding target is in [low, high)
+    size_t low = 0;
+    size_t high;
+    size_t mid;
+    unsigned int index;
+
     // Check input for NULL ptr before dereferencing it
 	if(buffer == NULL)
     	return NULL;
@@ -43,36 +94,34 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     // Check input for NULL ptr before dereferencing it
 	if(entry_offset_byte_rtn == NULL)
     	return NULL;
-    	
-    // The first location in the entry structure to read from; stored in local var
-    out_offs = buffer->out_offs;
-    
-    
-    // Loop until max possible reached
-    while (entry_num < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+
+    // NULL returned if pos not available in buffer (not enough data is written).
+    if (char_offset >= aesd_circular_buffer_size(buffer))
+        return NULL;
+
+    target = buffer->entry[buffer->out_offs].start + char_offset;
+    high = aesd_circular_buffer_count(buffer);
+
+    // Find the newest entry starting at or before target.  Zero length entries share their start with
+    // the following entry, so taking the newest skips them.
+    while (high - low > 1)
     {
-        // If char_offset less than size, offset within buffer
-        if (char_offset < total_offset + buffer->entry[out_offs].size) 
-        {
-            // pointer specifying a location to store the byte of the returned aesd_buffer_entry buffptr mem corresponding to char_offset
-            // set when a matching char_offset is found in aesd_buffer
-            *entry_offset_byte_rtn = char_offset - total_offset;
-            // struct aesd_buffer_entry structure representing the position described by char_offset returned
-            return &(buffer->entry[out_offs]);
-        }
-        
-        // Increase total_offset when going to next entry
-        total_offset += buffer->entry[out_offs].size;
-        
-        //  Increment out_offs; If max support val reached, wrap around index to 0, CB
-        out_offs = (out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;    	
-    	
-    	// Increment entry_num to loop
-    	entry_num++;
+        mid = low + (high - low) / 2;
+        index = (buffer->out_offs + mid) % buffer->capacity;
+
+        if (buffer->entry[index].start <= target)
+            low = mid;
+        else
+            high = mid;
     }
-    
-    // NULL returned if pos not available in buffer (not enough data is written).	
-    return NULL;	
+
+    index = (buffer->out_offs + low) % buffer->capacity;
+
+    // pointer specifying a location to store the byte of the returned aesd_buffer_entry buffptr mem corresponding to char_offset
+    *entry_offset_byte_rtn = target - buffer->entry[index].start;
+
+    // struct aesd_buffer_entry structure representing the position described by char_offset returned
+    return &(buffer->entry[index]);
 }
 
 /**
@@ -81,6 +130,7 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
 * new start location.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* @return the buffptr of the overwritten oldest entry, for the caller to free, or NULL if the buffer was not full
 */
 const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
@@ -106,15 +156,18 @@ const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     // size_t size; Number of bytes stored in buffptr
     // size member of entry struct inside buffer at index in_offs loaded with buffptr of add_entry struct
     buffer->entry[buffer->in_offs].size = add_entry->size;
+
+    // Prefix sum: the new entry starts where all previously added bytes end
+    buffer->entry[buffer->in_offs].start = buffer->total_added;
+    buffer->total_added += add_entry->size;
     
     // Increment in_offs; If max support val reached, wrap around index to 0, CB
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->in_offs = (buffer->in_offs + 1) % buffer->capacity;
     
     // 2. If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the new start location.
     // in_offs = current location in the entry structure where the next write should be stored.
     if (buffer->full)
     {
-    	ret = buffer->entry[buffer->in_offs].buffptr;  //return buffer to free b4 overwrite
         buffer->out_offs = buffer->in_offs;
     }
     else if (buffer->out_offs == buffer->in_offs)   // Check if both indexes match, if so CB full
@@ -123,10 +176,96 @@ const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     return ret;	
 }
 
+/**
+* Removes the oldest entry from @param buffer, making room without adding a new entry.
+* Any necessary locking must be handled by the caller
+* @return the buffptr of the removed entry, for the caller to free, or NULL if the buffer is empty
+*/
+const char *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer)
+{
+    const char *ret;
+
+    if (buffer == NULL || aesd_circular_buffer_count(buffer) == 0)
+        return NULL;
+
+    ret = buffer->entry[buffer->out_offs].buffptr;
+    buffer->entry[buffer->out_offs].buffptr = NULL;
+    buffer->entry[buffer->out_offs].size = 0;
+
+    buffer->out_offs = (buffer->out_offs + 1) % buffer->capacity;
+    buffer->full = false;
+
+    return ret;
+}
+
+/**
+* Checks whether adding an entry of @param add_size bytes would take the stored entries of @param buffer
+* over its max_bytes budget.  The caller evicts with aesd_circular_buffer_remove_oldest() while this
+* returns true, then adds the entry.  An entry larger than the whole budget is still stored, alone.
+* Any necessary locking must be handled by the caller
+* @return true if the oldest entry should be removed first
+*/
+bool aesd_circular_buffer_over_budget(const struct aesd_circular_buffer *buffer, size_t add_size)
+{
+    if (buffer == NULL || buffer->max_bytes == 0 || aesd_circular_buffer_count(buffer) == 0)
+        return false;
+
+    return aesd_circular_buffer_size(buffer) + add_size > buffer->max_bytes;
+}
+
+/**
+* Moves the entries of @param buffer, oldest first, into @param storage, an array of @param capacity
+* entries, which becomes the buffer's entry array.  Offsets seen by readers do not change.
+* The caller must first remove entries (aesd_circular_buffer_remove_oldest) until they fit.
+* Any necessary locking must be handled by the caller
+* @return the previous entry array for the caller to release (it may be buffer->default_entry), or NULL
+* if the arguments are invalid or the stored entries do not fit in @param capacity
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_relocate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, unsigned int capacity)
+{
+    struct aesd_buffer_entry *old_entry;
+    size_t count, index;
+
+    if (buffer == NULL || storage == NULL || capacity == 0 || storage == buffer->entry)
+        return NULL;
+
+    count = aesd_circular_buffer_count(buffer);
+    if (count > capacity)
+        return NULL;
+
+    memset(storage, 0, capacity * sizeof(struct aesd_buffer_entry));
+    for (index = 0; index < count; index++)
+        storage[index] = buffer->entry[(buffer->out_offs + index) % buffer->capacity];
+
+    old_entry = buffer->entry;
+    buffer->entry = storage;
+    buffer->capacity = capacity;
+    buffer->out_offs = 0;
+    buffer->in_offs = count % capacity;
+    buffer->full = (count == capacity);
+
+    return old_entry;
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct holding up to
+* @param capacity entries in @param storage, an array owned by the caller
+*/
+void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, unsigned int capacity)
+{
+    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    memset(storage,0,capacity * sizeof(struct aesd_buffer_entry));
+    buffer->entry = storage;
+    buffer->capacity = capacity;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
-    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    aesd_circular_buffer_init_storage(buffer, buffer->default_entry, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
 }
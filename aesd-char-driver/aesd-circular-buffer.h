@@ -16,6 +16,10 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Default number of entries, used by aesd_circular_buffer_init().  Buffers set up with
+ * aesd_circular_buffer_init_storage() can hold any number of entries.
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
 struct aesd_buffer_entry
@@ -28,27 +32,52 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Running prefix sum, set by aesd_circular_buffer_add_entry and ignored in add_entry: the number of
+     * bytes added to the buffer before this entry, i.e. its offset in the stream of every byte ever added.
+     * The char offset of an entry is its start minus the start of the oldest entry.
+     */
+    uint64_t start;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations.
+     * Points at default_entry, or at caller provided storage of capacity entries.
+     */
+    struct aesd_buffer_entry  *entry;
+    /**
+     * Number of entries in the entry array
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int capacity;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    unsigned int in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    unsigned int out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Total number of bytes ever added; the stream offset one past the newest entry
+     */
+    uint64_t total_added;
+    /**
+     * Byte budget for the stored entries, 0 for none.  Enforced by the caller through
+     * aesd_circular_buffer_over_budget(); the entry count is still capped by capacity.
+     */
+    size_t max_bytes;
+    /**
+     * Storage used by aesd_circular_buffer_init().  entry points into the struct itself in that case,
+     * so such a buffer must not be copied by value.
+     */
+    struct aesd_buffer_entry  default_entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
@@ -58,14 +87,31 @@ extern const char* aesd_circular_buffer_add_entry(struct aesd_circular_buffer *b
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, unsigned int capacity);
+
+extern const char *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_relocate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, unsigned int capacity);
+
+extern bool aesd_circular_buffer_over_budget(const struct aesd_circular_buffer *buffer, size_t add_size);
+
+extern size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer);
+
+extern size_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *char_offset_rtn);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is an unsigned int stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * unsigned int index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +120,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->capacity; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
@@ -38,9 +38,96 @@ struct aesd_seekto {
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+
+/**
+ * Resize the circular buffer to hold the given number of write commands (1 to AESDCHAR_MAX_ENTRIES_LIMIT).
+ * When shrinking, the oldest commands are dropped; the newest ones are always kept.
+ */
+#define AESDCHAR_IOCRESIZE _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+
+/**
+ * One byte range for AESDCHAR_IOCREADV: len bytes starting write_cmd_offset bytes into the zero
+ * referenced write command write_cmd.  The range may continue into the following commands.
+ */
+struct aesd_read_desc {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+    uint32_t len;
+    /**
+     * Set by the driver: bytes of this range stored in the buffer, which is less than len at the end
+     * of the stored commands, when the buffer is full or when the range was evicted during the call
+     */
+    uint32_t result;
+};
+
+/**
+ * Argument of AESDCHAR_IOCREADV.  The ranges are copied back to back into buf, in descriptor order.
+ * Pointers are passed as 64 bit integers so the layout is the same for 32 and 64 bit user space.
+ */
+struct aesd_readv {
+    uint64_t descs;        /* struct aesd_read_desc *, read and updated by the driver */
+    uint32_t count;        /* Number of descriptors, at most AESDCHAR_READV_MAX_DESCS */
+    uint32_t reserved;     /* Must be 0 */
+    uint64_t buf;          /* char *, receives the data */
+    uint64_t buf_len;      /* Size of buf */
+    uint64_t total;        /* Set by the driver: bytes stored in buf */
+};
+
+#define AESDCHAR_READV_MAX_DESCS 256
+
+/**
+ * Read several byte ranges without moving the file position.  All descriptors are checked under a single
+ * lock acquisition; fails with EINVAL, copying nothing, if any names a missing command or an offset past its
+ * end.  The data is then copied in pieces of up to 64 KiB, so a range evicted by writers meanwhile may come
+ * back shorter than first computed; result always gives the bytes actually copied.
+ */
+#define AESDCHAR_IOCREADV _IOWR(AESD_IOC_MAGIC, 3, struct aesd_readv)
+
+/**
+ * Upper bound for the buffer capacity, for both the max_entries module parameter and AESDCHAR_IOCRESIZE
+ */
+#define AESDCHAR_MAX_ENTRIES_LIMIT 65536
+
+/**
+ * Layout of the read-only mapping returned by mmap() on the device (offset 0, up to
+ * data_offset + data_size bytes).  The first page holds struct aesd_mmap_header followed by a table
+ * of the newest entries; the data ring starts at data_offset.  An entry's bytes are at ring
+ * position start % data_size and wrap around the end of the ring.
+ *
+ * seq is odd while the driver updates the mapping.  Readers load seq (acquire), retry while it is
+ * odd, copy what they need, then load seq again (after an acquire fence) and retry if it changed.
+ */
+#define AESD_MMAP_MAGIC 0x41455344   /* "AESD" */
+#define AESD_MMAP_VERSION 1
+
+struct aesd_mmap_entry {
+    /**
+     * Offset of the entry in the stream of every byte ever written; the char offset used by
+     * read()/lseek() is start minus the start of the oldest entry in the circular buffer
+     */
+    uint64_t start;
+    /**
+     * Number of bytes in the entry, including the terminating newline
+     */
+    uint64_t size;
+};
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;                 /* Sequence counter, odd during updates */
+    uint32_t max_entries;         /* Slots in entries[] */
+    uint64_t data_offset;         /* Offset of the data ring from the start of the mapping */
+    uint64_t data_size;           /* Size of the data ring in bytes */
+    uint64_t head;                /* Stream offset one past the newest byte */
+    uint32_t first;               /* Slot of the oldest valid entry */
+    uint32_t count;               /* Number of valid entries, oldest first from slot first */
+    struct aesd_mmap_entry entries[];
+};
+
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
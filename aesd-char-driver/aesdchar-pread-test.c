@@ -0,0 +1,194 @@
+/*
+ * Filename   : aesdchar-pread-test.c
+ *
+ * Description: Checks how file offsets behave across evictions on an aesdchar device.
+ *            : Positioned reads (pread) use the char offset they are given, counted from the oldest stored
+ *            : command, whether or not entries were evicted since the last read. A plain read() continuing from
+ *            : where the previous one stopped keeps its place in the stream instead.
+ *            :
+ *            : The test shrinks the buffer to TEST_ENTRIES commands with AESDCHAR_IOCRESIZE and fills it with its
+ *            : own lines, then restores the max_entries load parameter at the end. Run it on a device nobody else
+ *            : is writing to.
+ *
+ * Usage      : aesdchar-pread-test [-f device]
+ *
+ * Author     : Swathi Venkatachalam
+ *
+ * Reference  : [1] pread - https://www.man7.org/linux/man-pages/man2/pread.2.html
+ *            : [2] ioctl - https://www.man7.org/linux/man-pages/man2/ioctl.2.html
+ */
+
+/*************************************************************************
+ *                            Header Files                               *
+ *************************************************************************/
+
+#include <stdio.h>                               // Standard input output library
+#include <stdlib.h>                              // General purpose utility functions
+#include <string.h>                              // String manipulations
+#include <stdint.h>                              // uint32_t
+#include <unistd.h>                              // POSIX API; read, write, pread, getopt
+#include <fcntl.h>                               // open
+#include <sys/ioctl.h>                           // ioctl
+#include "aesd_ioctl.h"                          // AESDCHAR_IOCRESIZE
+
+/*************************************************************************
+ *                            Macros                                     *
+ *************************************************************************/
+
+#define SUCCESS                           (0)
+#define FAILURE                           (1)
+
+#define DEFAULT_DEVICE                    ("/dev/aesdchar")
+#define MAX_ENTRIES_PARAM                 ("/sys/module/aesdchar/parameters/max_entries")
+#define TEST_ENTRIES                      (4)
+#define LINE_LEN                          (9)    // "pread NN\n"
+
+/*************************************************************************
+ *                  Global Variables                                     *
+ *************************************************************************/
+
+const char *device = DEFAULT_DEVICE;
+int failures;
+
+/*************************************************************************
+ *                        Helper Functions                               *
+ *************************************************************************/
+
+// Write line number n, LINE_LEN bytes
+int write_line(int fd, int n)
+{
+    char line[LINE_LEN + 1];
+
+    snprintf(line, sizeof(line), "pread %02d\n", n);
+    if (write(fd, line, LINE_LEN) != LINE_LEN)
+    {
+        perror("write");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+// Compare what a read returned with line number n
+void expect_line(const char *what, const char *buffer, ssize_t len, int n)
+{
+    char line[LINE_LEN + 1];
+
+    snprintf(line, sizeof(line), "pread %02d\n", n);
+    if (len != LINE_LEN || memcmp(buffer, line, LINE_LEN) != 0)
+    {
+        printf("FAIL %s: expected line %d, got %zd bytes \"%.*s\"\n", what, n, len,
+               len > 0 ? (int)len - 1 : 0, buffer);
+        failures++;
+    }
+    else
+        printf("ok   %s\n", what);
+}
+
+// Ref: [1] man page
+void expect_pread(const char *what, int fd, off_t offset, int n)
+{
+    char buffer[LINE_LEN];
+
+    expect_line(what, buffer, pread(fd, buffer, LINE_LEN, offset), n);
+}
+
+void expect_read(const char *what, int fd, int n)
+{
+    char buffer[LINE_LEN];
+
+    expect_line(what, buffer, read(fd, buffer, LINE_LEN), n);
+}
+
+// Ref: [2] man page
+int resize(int fd, uint32_t entries)
+{
+    if (ioctl(fd, AESDCHAR_IOCRESIZE, &entries) != 0)
+    {
+        perror("AESDCHAR_IOCRESIZE");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*************************************************************************
+ *                       Main Function                                   *
+ *************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    char buffer[2 * LINE_LEN];
+    unsigned int max_entries = 0;
+    int writer, reader, positioned;
+    int opt, n;
+    FILE *param;
+
+    while ((opt = getopt(argc, argv, "f:")) != -1)
+    {
+        if (opt == 'f')
+            device = optarg;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-f device]\n", argv[0]);
+            return FAILURE;
+        }
+    }
+
+    writer = open(device, O_WRONLY);
+    reader = open(device, O_RDONLY);
+    positioned = open(device, O_RDONLY);
+    if (writer == -1 || reader == -1 || positioned == -1)
+    {
+        perror(device);
+        return FAILURE;
+    }
+
+    // Start from TEST_ENTRIES lines of our own: 0 1 2 3
+    if (resize(writer, TEST_ENTRIES) != SUCCESS)
+        return FAILURE;
+    for (n = 0; n < TEST_ENTRIES; n++)
+        if (write_line(writer, n) != SUCCESS)
+            return FAILURE;
+
+    // The reader stops after line 1, then lines 0 and 1 are evicted: 2 3 4 5
+    if (read(reader, buffer, sizeof(buffer)) != sizeof(buffer))
+    {
+        perror("read");
+        return FAILURE;
+    }
+    for (; n < TEST_ENTRIES + 2; n++)
+        if (write_line(writer, n) != SUCCESS)
+            return FAILURE;
+
+    // Explicit offsets are char offsets into what is stored now, even from a file left mid-stream by read()
+    expect_pread("pread at offset 0 after evictions", reader, 0, 2);
+    expect_pread("pread at offset 1 line after evictions", reader, LINE_LEN, 3);
+    expect_pread("pread at offset 3 lines after evictions", reader, 3 * LINE_LEN, 5);
+    expect_pread("pread on a pread-only file", positioned, LINE_LEN, 3);
+
+    // read() carries on with the line after the last one it returned, which now sits at char offset 0
+    expect_read("read continues after evictions", reader, 2);
+
+    // Evict again: 4 5 6 7. A file only used with pread has nothing to continue, offset 0 is the oldest line
+    for (; n < TEST_ENTRIES + 4; n++)
+        if (write_line(writer, n) != SUCCESS)
+            return FAILURE;
+    expect_pread("pread-only file at offset 0 after more evictions", positioned, 0, 4);
+    expect_pread("pread-only file at offset 2 lines after more evictions", positioned, 2 * LINE_LEN, 6);
+    // Line 3, where the reader stopped, is gone too: it resumes at the oldest line
+    expect_read("read resumes at the oldest line once its next one is evicted", reader, 4);
+
+    // Put the load time capacity back
+    param = fopen(MAX_ENTRIES_PARAM, "r");
+    if (param != NULL)
+    {
+        if (fscanf(param, "%u", &max_entries) == 1)
+            resize(writer, max_entries);
+        fclose(param);
+    }
+
+    close(positioned);
+    close(reader);
+    close(writer);
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? FAILURE : SUCCESS;
+}
@@ -0,0 +1,229 @@
+/*
+ * Filename   : aesdchar-read-bench.c
+ *
+ * Description: User space contention benchmark for the aesdchar driver.
+ *            : For 1, 2, 4 ... max readers, each reader thread opens the device and repeatedly reads the
+ *            : whole circular buffer from offset 0 for the given duration. Optionally one writer thread
+ *            : keeps adding entries at the same time. Reports reads and bytes per second for each reader
+ *            : count, so the scaling of concurrent readers can be compared across driver changes.
+ *
+ * Usage      : aesdchar-read-bench [-f device] [-r max_readers] [-t seconds] [-w]
+ *
+ * Author     : Swathi Venkatachalam
+ *
+ * Reference  : [1] pthread_create - https://www.man7.org/linux/man-pages/man3/pthread_create.3.html
+ *            : [2] clock_gettime  - https://www.man7.org/linux/man-pages/man2/clock_gettime.2.html
+ *            : [3] pread          - https://www.man7.org/linux/man-pages/man2/pread.2.html
+ */
+
+/*************************************************************************
+ *                            Header Files                               *
+ *************************************************************************/
+
+#include <stdio.h>                               // Standard input output library
+#include <stdlib.h>                              // General purpose utility functions
+#include <string.h>                              // String manipulations
+#include <stdbool.h>                             // bool
+#include <stdatomic.h>                           // atomic_bool stop flag
+#include <unistd.h>                              // POSIX API; read, write, getopt
+#include <fcntl.h>                               // open
+#include <pthread.h>                             // POSIX threads library
+#include <time.h>                                // clock_gettime, nanosleep
+
+/*************************************************************************
+ *                            Macros                                     *
+ *************************************************************************/
+
+#define SUCCESS                           (0)
+#define FAILURE                           (1)
+
+#define DEFAULT_DEVICE                    ("/dev/aesdchar")
+#define DEFAULT_MAX_READERS               (8)
+#define DEFAULT_SECONDS                   (2)
+#define READ_BUFFER_SIZE                  (4096)
+#define PREFILL_ENTRIES                   (10)
+
+/*************************************************************************
+ *                        Structures                                     *
+ *************************************************************************/
+
+struct reader_result
+{
+    pthread_t thread_id;
+    unsigned long long reads;                   // read() calls returning data
+    unsigned long long bytes;                   // Bytes returned by those calls
+    bool failed;
+};
+
+/*************************************************************************
+ *                  Global Variables                                     *
+ *************************************************************************/
+
+const char *device = DEFAULT_DEVICE;
+atomic_bool stop_flag;                          // Set by main when the measurement window ends
+
+/*************************************************************************
+ *                        Thread Functions                               *
+ *************************************************************************/
+
+void *reader_thread(void *arg)
+{
+    struct reader_result *result = arg;
+    char buffer[READ_BUFFER_SIZE];
+    off_t offset;
+    ssize_t read_bytes;
+    int fd;
+
+    fd = open(device, O_RDONLY);
+    if (fd == -1)
+    {
+        result->failed = true;
+        return NULL;
+    }
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed))
+    {
+        // Ref: [3] man page
+        // One pass over the whole buffer; pread keeps the file position out of the measurement
+        offset = 0;
+        while ((read_bytes = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+        {
+            result->reads++;
+            result->bytes += read_bytes;
+            offset += read_bytes;
+        }
+        if (read_bytes == -1)
+        {
+            result->failed = true;
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+void *writer_thread(void *arg)
+{
+    unsigned long long *writes = arg;
+    char line[64];
+    int fd, len;
+
+    fd = open(device, O_WRONLY);
+    if (fd == -1)
+        return NULL;
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed))
+    {
+        len = snprintf(line, sizeof(line), "bench write %llu\n", *writes);
+        if (write(fd, line, len) != len)
+            break;
+        (*writes)++;
+    }
+    close(fd);
+    return NULL;
+}
+
+/*************************************************************************
+ *                       Main Function                                   *
+ *************************************************************************/
+
+double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_readers = DEFAULT_MAX_READERS;
+    int seconds = DEFAULT_SECONDS;
+    bool with_writer = false;
+    int opt, readers, i, fd;
+
+    while ((opt = getopt(argc, argv, "f:r:t:w")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': device = optarg; break;
+            case 'r': max_readers = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'w': with_writer = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f device] [-r max_readers] [-t seconds] [-w]\n", argv[0]);
+                return FAILURE;
+        }
+    }
+    if (max_readers < 1 || seconds < 1)
+    {
+        fprintf(stderr, "max_readers and seconds must be positive\n");
+        return FAILURE;
+    }
+
+    // Make sure there is something to read
+    fd = open(device, O_WRONLY);
+    if (fd == -1)
+    {
+        perror(device);
+        return FAILURE;
+    }
+    for (i = 0; i < PREFILL_ENTRIES; i++)
+    {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "bench prefill %d\n", i);
+        if (write(fd, line, len) != len)
+        {
+            perror("write");
+            close(fd);
+            return FAILURE;
+        }
+    }
+    close(fd);
+
+    printf("# device=%s seconds=%d writer=%s\n", device, seconds, with_writer ? "yes" : "no");
+    printf("%-8s %14s %14s %14s %12s\n", "readers", "reads/s", "MB/s", "reads/s/rdr", "writes/s");
+
+    for (readers = 1; readers <= max_readers; readers *= 2)
+    {
+        struct reader_result *results = calloc(readers, sizeof(*results));
+        unsigned long long total_reads = 0, total_bytes = 0, writes = 0;
+        struct timespec start, end, window = { seconds, 0 };
+        pthread_t writer_id;
+        bool failed = false;
+        double elapsed;
+
+        if (results == NULL)
+            return FAILURE;
+
+        atomic_store(&stop_flag, false);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // Ref: [1] man page
+        for (i = 0; i < readers; i++)
+            pthread_create(&results[i].thread_id, NULL, reader_thread, &results[i]);
+        if (with_writer)
+            pthread_create(&writer_id, NULL, writer_thread, &writes);
+
+        nanosleep(&window, NULL);
+        atomic_store(&stop_flag, true);
+
+        for (i = 0; i < readers; i++)
+        {
+            pthread_join(results[i].thread_id, NULL);
+            total_reads += results[i].reads;
+            total_bytes += results[i].bytes;
+            failed |= results[i].failed;
+        }
+        if (with_writer)
+            pthread_join(writer_id, NULL);
+
+        // Ref: [2] man page
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = elapsed_seconds(&start, &end);
+
+        printf("%-8d %14.0f %14.2f %14.0f %12.0f%s\n", readers,
+               total_reads / elapsed, total_bytes / elapsed / (1024 * 1024),
+               total_reads / elapsed / readers, writes / elapsed,
+               failed ? "  (reader errors)" : "");
+        free(results);
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,140 @@
+/*
+ * aesdchar-trace.h
+ *
+ *  Static tracepoints for the aesdchar data path. With tracing off each one is a patched-out branch;
+ *  enable them with ftrace (/sys/kernel/tracing/events/aesdchar/) or perf (-e 'aesdchar:*').
+ *
+ *  main.c defines CREATE_TRACE_POINTS before including this header, so it is read more than once.
+ *
+ *  Ref: https://www.kernel.org/doc/html/latest/trace/tracepoints.html
+ *       https://elixir.bootlin.com/linux/latest/source/samples/trace_events/trace-events-sample.h
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/**
+ * A write command was committed to the circular buffer
+ */
+TRACE_EVENT(aesd_add_entry,
+    TP_PROTO(unsigned int minor, size_t size, unsigned int count, size_t total),
+    TP_ARGS(minor, size, count, total),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, size)
+        __field(unsigned int, count)
+        __field(size_t, total)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->size = size;
+        __entry->count = count;
+        __entry->total = total;
+    ),
+    TP_printk("minor=%u size=%zu entries=%u bytes=%zu",
+              __entry->minor, __entry->size, __entry->count, __entry->total)
+);
+
+/**
+ * The oldest command was freed to make room, or by a shrinking resize
+ */
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(unsigned int minor, size_t size),
+    TP_ARGS(minor, size),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->size = size;
+    ),
+    TP_printk("minor=%u size=%zu", __entry->minor, __entry->size)
+);
+
+/**
+ * One read_iter call; ret is the bytes copied or an error, duration_ns includes lock waits but not a blocking wait
+ */
+TRACE_EVENT(aesd_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t requested, ssize_t ret, u64 duration_ns),
+    TP_ARGS(minor, pos, requested, ret, duration_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, requested)
+        __field(ssize_t, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->requested = requested;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("minor=%u pos=%lld requested=%zu ret=%zd duration_ns=%llu",
+              __entry->minor, __entry->pos, __entry->requested, __entry->ret,
+              (unsigned long long)__entry->duration_ns)
+);
+
+/**
+ * One write call; committed is true when it completed a line and added it to the buffer
+ */
+TRACE_EVENT(aesd_write,
+    TP_PROTO(unsigned int minor, size_t count, ssize_t ret, bool committed, u64 duration_ns),
+    TP_ARGS(minor, count, ret, committed, duration_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(bool, committed)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->committed = committed;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("minor=%u count=%zu ret=%zd committed=%d duration_ns=%llu",
+              __entry->minor, __entry->count, __entry->ret, __entry->committed,
+              (unsigned long long)__entry->duration_ns)
+);
+
+/**
+ * llseek (whence SEEK_SET/CUR/END), or AESDCHAR_IOCSEEKTO with whence -1 and offset set to write_cmd;
+ * result is the new position or an error
+ */
+TRACE_EVENT(aesd_seek,
+    TP_PROTO(unsigned int minor, loff_t offset, int whence, loff_t result),
+    TP_ARGS(minor, offset, whence, result),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, offset)
+        __field(int, whence)
+        __field(loff_t, result)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->result = result;
+    ),
+    TP_printk("minor=%u offset=%lld whence=%d result=%lld",
+              __entry->minor, __entry->offset, __entry->whence, __entry->result)
+);
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar-trace
+#include <trace/define_trace.h>
@@ -10,7 +10,18 @@
 
 #include "aesd-circular-buffer.h"
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+/**
+ * Lines up to this many bytes are allocated from the device's kmem_cache; longer ones use kvmalloc
+ */
+#define AESD_LINE_CACHE_SIZE 256
+
+/**
+ * Upper bound for the num_devices module parameter
+ */
+#define AESDCHAR_MAX_DEVICES 64
+
+// AESD_DEBUG comes from the Makefile (make DEBUG=y); production builds compile PDEBUG out.
+// Use the aesdchar tracepoints (aesdchar-trace.h) to look at the data path of a release build.
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -30,12 +41,38 @@ struct aesd_dev
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
-    struct mutex lock;     // mutual exclusion semaphore  
+    struct rw_semaphore lock;     // readers (read, llseek, ioctl seek) share it; aesd_write holds it exclusively
     struct aesd_circular_buffer buffer;  // CB struct
     struct cdev cdev;     /* Char device structure      */
     
-    struct aesd_buffer_entry write_entry;    // For aesd_write function
+    struct aesd_buffer_entry orphan_entry;   // Partial line left by a closed file, continued by the next writer
+    size_t orphan_capacity;                  // Bytes allocated for orphan_entry.buffptr
+    struct mutex orphan_lock;                // Protects orphan_entry; never held with lock
+    struct kmem_cache *line_cache;           // AESD_LINE_CACHE_SIZE objects for short lines
+    char line_cache_name[24];
+    struct aesd_mmap_header *mmap_area;      // vmalloc_user mirror of the newest entries, NULL until the first mmap()
+    wait_queue_head_t readq;                 // Readers waiting for a new entry (blocking read, poll)
+    unsigned long commits;                   // Entries committed so far; bumped under lock before waking readq
+};
+
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    spinlock_t pos_lock;   // Protects the last_pos/last_abs pair; readers sharing the file only hold dev->lock shared
+    loff_t last_pos;       // f_pos left by the last read(2) at the file position, -1 if none to continue from
+    uint64_t last_abs;     // The same position as a stream offset, to rebase f_pos after evictions
+    struct aesd_buffer_entry write_entry;    // For aesd_write function; line being assembled until its '\n'
+    size_t write_capacity;                   // Bytes allocated for write_entry.buffptr
+    struct mutex write_lock;                 // Serializes writes through this file, taken before dev->lock
 };
 
+static inline struct aesd_dev *aesd_file_dev(struct file *filp)
+{
+    return ((struct aesd_file *)filp->private_data)->dev;
+}
+
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -22,12 +22,26 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/rwsem.h> // rw_semaphore; readers share the device, writers are exclusive
+#include <linux/spinlock.h> // per-file pos_lock
 #include "aesdchar.h"
 
 #include <linux/slab.h>  // For memory allocation functions
+#include <linux/mm.h>    // kvcalloc, kvfree for the entry array
+#include <linux/moduleparam.h>
+#include <linux/uio.h>     // iov_iter for read_iter
+#include <linux/splice.h>  // copy_splice_read
+#include <linux/version.h>
+#include <linux/vmalloc.h> // vmalloc_user, remap_vmalloc_range for mmap
+#include <linux/wait.h>    // wait queue for blocking reads and poll
+#include <linux/poll.h>
+#include <linux/ktime.h>   // ktime_get_ns for the tracepoint durations
 
 #include "aesd_ioctl.h" // Added for A9
 
+#define CREATE_TRACE_POINTS
+#include "aesdchar-trace.h"
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
@@ -36,11 +50,159 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 #define SUCCESS (0)  // Return cod checking macro
 
-struct aesd_dev aesd_device;
+#define AESD_READV_CHUNK (64 * 1024)  // Bounce buffer limit for AESDCHAR_IOCREADV; bytes copied per lock hold
+
+// Number of write commands kept in the circular buffer; set at load time, e.g. ./aesdchar_load max_entries=100,
+// and changed at run time with AESDCHAR_IOCRESIZE
+static unsigned int max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(max_entries, uint, 0444);
+MODULE_PARM_DESC(max_entries, "Number of write commands kept in the circular buffer (1 to 65536)");
+
+// Optional byte budget, e.g. ./aesdchar_load max_bytes=1048576: oldest commands are freed until the stored bytes
+// plus the new command fit. 0 keeps the count limit only. Both limits apply when set.
+static unsigned long max_bytes = 0;
+module_param(max_bytes, ulong, 0444);
+MODULE_PARM_DESC(max_bytes, "Byte budget for the stored write commands, 0 for no budget");
+
+// Size of the data ring mirrored for mmap() readers, rounded up to whole pages; 0 disables mmap.
+// Each device allocates one header page plus this much vmalloc memory on its first mmap(), and keeps it until
+// the module is unloaded; devices that are never mapped cost nothing.
+static unsigned long mmap_size = 1024 * 1024;
+module_param(mmap_size, ulong, 0444);
+MODULE_PARM_DESC(mmap_size, "Bytes of command history exposed through mmap(), 0 to disable");
+
+// Readers at the end of the buffer sleep until the next command instead of getting 0 (EOF), unless the file was
+// opened O_NONBLOCK. Off by default since tools like cat rely on EOF. Writable at run time through sysfs.
+static bool blocking_read = false;
+module_param(blocking_read, bool, 0644);
+MODULE_PARM_DESC(blocking_read, "Block reads at the end of the buffer until a new command is written");
+
+// Number of devices (minors), each with its own buffer and locks: /dev/aesdchar, /dev/aesdchar1, ...
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of aesdchar devices to create (1 to 64)");
+
+struct aesd_dev *aesd_devices;
+
+// Line buffers up to AESD_LINE_CACHE_SIZE bytes come from the device's slab cache, longer ones from kvmalloc.
+// A stored entry is released by its size: the pending entry only leaves the cache once it outgrows it.
+static void *aesd_line_alloc(struct aesd_dev *dev, size_t capacity)
+{
+    if (capacity <= AESD_LINE_CACHE_SIZE)
+        return kmem_cache_alloc(dev->line_cache, GFP_KERNEL);
+    return kvmalloc(capacity, GFP_KERNEL);
+}
+
+static void aesd_line_free(struct aesd_dev *dev, const char *buffptr, size_t size)
+{
+    if (buffptr == NULL)
+        return;
+    if (size <= AESD_LINE_CACHE_SIZE)
+        kmem_cache_free(dev->line_cache, (void *)buffptr);
+    else
+        kvfree(buffptr);
+}
+
+// Free the oldest entry of the circular buffer; caller holds dev->lock for writing
+static void aesd_evict_oldest(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *oldest = aesd_circular_buffer_get_entry(&dev->buffer, 0, NULL);
+    size_t size;
+
+    if (oldest == NULL)
+        return;
+    size = oldest->size;
+    aesd_line_free(dev, aesd_circular_buffer_remove_oldest(&dev->buffer), size);
+    trace_aesd_evict(MINOR(dev->cdev.dev), size);
+}
+
+// Stored entries are freed by their size, so before a line is committed its buffer is moved to the allocation
+// that size implies: a cache object up to AESD_LINE_CACHE_SIZE bytes, an exact kvmalloc above. This also drops
+// the slack left by growing the pending entry, so max_bytes bounds the memory the buffer holds.
+// Returns false if the line needs a cache object and none could be allocated.
+static bool aesd_fit_line(struct aesd_dev *dev, struct aesd_file *file)
+{
+    size_t size = file->write_entry.size;
+    size_t fitted = max_t(size_t, size, AESD_LINE_CACHE_SIZE);
+    char *buffptr;
+
+    if (file->write_capacity == fitted)
+        return true;
+
+    buffptr = aesd_line_alloc(dev, fitted);
+    if (buffptr == NULL)
+        return size > AESD_LINE_CACHE_SIZE;      // kvfree releases the larger buffer just as well
+    memcpy(buffptr, file->write_entry.buffptr, size);
+    aesd_line_free(dev, file->write_entry.buffptr, file->write_capacity);
+    file->write_entry.buffptr = buffptr;
+    file->write_capacity = fitted;
+    return true;
+}
+
+// A file closed in the middle of a line leaves it to the device, and the next file to write there continues it,
+// as when all writers shared one pending entry. Lines parked by several files are joined in close order.
+static void aesd_park_partial_line(struct aesd_dev *dev, struct aesd_file *file)
+{
+    char *joined;
+    size_t size;
+
+    if (file->write_entry.size == 0)
+    {
+        aesd_line_free(dev, file->write_entry.buffptr, file->write_capacity);
+        return;
+    }
+
+    mutex_lock(&dev->orphan_lock);
+    if (dev->orphan_entry.size == 0)
+    {
+        aesd_line_free(dev, dev->orphan_entry.buffptr, dev->orphan_capacity);
+        dev->orphan_entry = file->write_entry;
+        dev->orphan_capacity = file->write_capacity;
+    }
+    else
+    {
+        size = dev->orphan_entry.size + file->write_entry.size;
+        joined = aesd_line_alloc(dev, max_t(size_t, size, AESD_LINE_CACHE_SIZE));
+        if (joined != NULL)
+        {
+            memcpy(joined, dev->orphan_entry.buffptr, dev->orphan_entry.size);
+            memcpy(joined + dev->orphan_entry.size, file->write_entry.buffptr, file->write_entry.size);
+            aesd_line_free(dev, dev->orphan_entry.buffptr, dev->orphan_capacity);
+            dev->orphan_entry.buffptr = joined;
+            dev->orphan_entry.size = size;
+            dev->orphan_capacity = max_t(size_t, size, AESD_LINE_CACHE_SIZE);
+        }
+        else
+            printk(KERN_WARNING "aesdchar: dropping %zu byte partial line, out of memory\n", file->write_entry.size);
+        aesd_line_free(dev, file->write_entry.buffptr, file->write_capacity);
+    }
+    mutex_unlock(&dev->orphan_lock);
+
+    file->write_entry.buffptr = NULL;
+    file->write_entry.size = 0;
+    file->write_capacity = 0;
+}
+
+// Continue a line parked by a file that was closed before writing its '\n'; called with an empty pending entry
+static void aesd_adopt_partial_line(struct aesd_dev *dev, struct aesd_file *file)
+{
+    struct aesd_buffer_entry entry;
+    size_t capacity;
+
+    mutex_lock(&dev->orphan_lock);
+    entry = dev->orphan_entry;
+    capacity = dev->orphan_capacity;
+    dev->orphan_entry = file->write_entry;
+    dev->orphan_capacity = file->write_capacity;
+    file->write_entry = entry;
+    file->write_capacity = capacity;
+    mutex_unlock(&dev->orphan_lock);
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
     struct aesd_dev *dev = NULL; // device information
+    struct aesd_file *file = NULL; // per open file state
     PDEBUG("open");
     // Ref: From my A7 scull_open function https://github.com/cu-ecen-aeld/assignment-7-SwathiVenkatachalam/blob/master/scull/main.c
     
@@ -49,19 +211,69 @@ int aesd_open(struct inode *inode, struct file *filp)
     // Get ptr to aesd_dev struct; i_cdev is a memeber of inode struct that holds ptr to cdev (char device struct mem of struct aesd_dev)
     dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
     
-    // Set file ptr filp->private_data with aesd_dev device struct
-    filp->private_data = dev; 
+    file = kzalloc(sizeof(*file), GFP_KERNEL);
+    if (file == NULL)
+        return -ENOMEM;
+    file->dev = dev;
+    file->last_pos = -1;   // no read yet; nothing to rebase
+    spin_lock_init(&file->pos_lock);
+    mutex_init(&file->write_lock);
+
+    // Set file ptr filp->private_data with the per open state, which points at the aesd_dev device struct
+    filp->private_data = file; 
 
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *file = filp->private_data;
+
     PDEBUG("release");
+    aesd_park_partial_line(file->dev, file);
+    mutex_destroy(&file->write_lock);
+    kfree(file);
     filp->private_data = NULL;
     return 0;
 }
 
+// Stream offset of the oldest stored byte; char offsets (f_pos) are relative to it. Caller holds dev->lock
+static uint64_t aesd_oldest_start(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *oldest = aesd_circular_buffer_get_entry(&dev->buffer, 0, NULL);
+
+    return oldest ? oldest->start : dev->buffer.total_added;
+}
+
+// A read(2) continuing from where the last one stopped keeps its place in the stream even if entries were
+// evicted since, which shifts every char offset down. read_iter gets a copy of f_pos for read(2), readv(2) and
+// splice without an offset, and the caller's own offset for pread(2), preadv(2) and splice with one; only a
+// read starting at the file position (@param sequential) is a continuation, positioned I/O elsewhere is never
+// rebased. The two cannot be told apart when a pread(2) offset equals f_pos, which then reads on like read(2).
+// lseek and the ioctl seek reset last_pos, so a seek that happens to land on it is not taken for one either.
+static loff_t aesd_rebase_pos(struct aesd_file *file, bool sequential, loff_t pos, uint64_t oldest_start)
+{
+    loff_t rebased = pos;
+
+    if (!sequential)
+        return pos;
+
+    spin_lock(&file->pos_lock);
+    if (pos == file->last_pos)
+        rebased = file->last_abs > oldest_start ? file->last_abs - oldest_start : 0;
+    spin_unlock(&file->pos_lock);
+    return rebased;
+}
+
+// Remember where a sequential read stopped, or with @param pos -1 that there is nothing to continue from
+static void aesd_save_read_pos(struct aesd_file *file, loff_t pos, uint64_t abs)
+{
+    spin_lock(&file->pos_lock);
+    file->last_pos = pos;
+    file->last_abs = abs;
+    spin_unlock(&file->pos_lock);
+}
+
 // Ref: Assignment-9-overview lecture slides
 // Ref: https://man7.org/linux/man-pages/man2/lseek.2.html
 
@@ -76,15 +288,12 @@ loff_t aesd_llseek(struct file * filp, loff_t offset, int whence)
 {
     int rc = 0; // return code storage variable
     
-    struct aesd_buffer_entry *entryptr = NULL;
-    int index = 0;
     loff_t buffer_size = 0; 
     // new file offset is returned; type loff_t is a 64-bit signed type.
     loff_t result = 0;
     
 	// file ptr filp->private_data is stored to aesd_dev device struct
     struct aesd_dev *dev = NULL;
-    dev = filp->private_data;    
     
     // Check input parameters validity first
     // filp - file pointer private_data member used to get aesd_dev
@@ -93,28 +302,18 @@ loff_t aesd_llseek(struct file * filp, loff_t offset, int whence)
     	PDEBUG("Input parameters of llseek function invalid\n");
         return -EINVAL;
     }
+    dev = aesd_file_dev(filp);
 	
 	// Lock for safe multi-threaded op
-	rc = mutex_lock_interruptible(&dev->lock); //  check in rc if lock acquisition interrupted by a signal
+	rc = down_read_interruptible(&dev->lock); //  shared with other readers; check in rc if lock acquisition interrupted by a signal
 	if (rc != SUCCESS)
 	{
 		PDEBUG("Lock failure in llseek;  lock acquisition was interrupted by a signal\n");
 		return -ERESTARTSYS;  //restart syscall code
 	}
-	printk("Locked for aesd_llseek function\n\n");
-	
 	// Ref: Assignment-9-overview lecture slide 11
-	// total size of all content of the circular buffer
-     /*
-    #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
-    for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
-            index++, entryptr=&((buffer)->entry[index]))*/
-            
-    AESD_CIRCULAR_BUFFER_FOREACH(entryptr,&aesd_device.buffer,index) 
-    {
-        buffer_size += entryptr->size;
-    }
+	// total size of all content of the circular buffer; O(1) from the buffer's running total
+    buffer_size = aesd_circular_buffer_size(&dev->buffer);
     
     // Ref: https://elixir.bootlin.com/linux/v5.3.8/source/fs/read_write.c#L144
     /**
@@ -142,15 +341,18 @@ loff_t aesd_llseek(struct file * filp, loff_t offset, int whence)
     if(result == -EINVAL) 
     {
 	    PDEBUG("llseek failure; exit\n"); 
-	    mutex_unlock(&dev->lock); // unlock mutex 
+	    up_read(&dev->lock); // unlock semaphore 
+	    trace_aesd_seek(MINOR(dev->cdev.dev), offset, whence, -EINVAL);
 	    return -EINVAL;
     }
     
     filp->f_pos = result; // Update file position
+    // An explicit seek is never a continuation of the last read, even if it lands on the same offset
+    aesd_save_read_pos(filp->private_data, -1, 0);
     
     PDEBUG("llseek success!\n");
-    mutex_unlock(&dev->lock); // unlock mutex 
-    printk("Unlocked after aesd_llseek function\n\n");
+    up_read(&dev->lock); // unlock semaphore 
+    trace_aesd_seek(MINOR(dev->cdev.dev), offset, whence, result);
     
     return result;
 }
@@ -160,12 +362,12 @@ loff_t aesd_llseek(struct file * filp, loff_t offset, int whence)
 static long aesd_adjust_file_offset (struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset)
 {
     size_t start_offset = 0;
-    int i = 0;
-	struct aesd_dev *dev = filp->private_data;
+    struct aesd_buffer_entry *entry = NULL;
+	struct aesd_dev *dev = aesd_file_dev(filp);
     int rc; // return code storage variable
 	
 	// Lock for safe multi-threaded op
-	rc = mutex_lock_interruptible(&dev->lock); //  check in rc if lock acquisition interrupted by a signal
+	rc = down_read_interruptible(&dev->lock); //  shared with other readers; check in rc if lock acquisition interrupted by a signal
 	if (rc != SUCCESS)
 	{
 		PDEBUG("Lock failure in adjust file offset;  lock acquisition was interrupted by a signal\n");
@@ -173,45 +375,366 @@ static long aesd_adjust_file_offset (struct file *filp, unsigned int write_cmd,
 	}
 	
 	// Check for valid write_cmd and write_cmd_offset values
-	// out of range cmd (11); write_cmd_offset is >= size of command
-	/*
-	if(write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
-	{	
-		return -EINVAL;
-	}
-
-	if(write_cmd_offset >= dev->buffer.entry[write_cmd].size)
-	{
-		printk("Offset not within the range of the buffer size \n");	
-		return -EINVAL;
-	}*/
-	
-	if((write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) || (write_cmd_offset >= dev->buffer.entry[write_cmd].size))
+	// write_cmd counts from the oldest entry (out_offs); out of range cmd, or write_cmd_offset >= size of command
+	// Calculate the start offset to write_cmd from the prefix sums, without adding up the entries before it
+	entry = aesd_circular_buffer_get_entry(&dev->buffer, write_cmd, &start_offset);
+	if((entry == NULL) || (write_cmd_offset >= entry->size))
     {
         PDEBUG("Invaid write_cmd, write_cmd_offset values\n");
-        mutex_unlock(&dev->lock); //unlock mutex
+        up_read(&dev->lock); // unlock semaphore
+        trace_aesd_seek(MINOR(dev->cdev.dev), write_cmd, -1, -EINVAL);
         return -EINVAL;
     }
-    
-    // Calculate the start offset to write_cmd; Add length of each write between the output pointer and write_cmd
 
-	for(i = 0; i < write_cmd; i++)
-    {
-        start_offset += dev->buffer.entry[i].size;
-    }
-    
-
-    mutex_unlock(&dev->lock); // unlock mutex 
+    up_read(&dev->lock); // unlock semaphore 
     
     // Add the write_cmd_offset
     // Save as filp->f_pos
     filp->f_pos = start_offset + write_cmd_offset;
-    
+    aesd_save_read_pos(filp->private_data, -1, 0);    // Not rebased by the next read, as for llseek
+    trace_aesd_seek(MINOR(dev->cdev.dev), write_cmd, -1, filp->f_pos);
     
     PDEBUG("adjust file offset success!\n");
     return 0;
 }
 
+// Copy len bytes from char offset pos into a kernel buffer, walking consecutive entries.
+// Caller holds dev->lock and has checked that the range is stored.
+static void aesd_copy_range(struct aesd_dev *dev, size_t pos, char *dest, size_t len)
+{
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset = 0;
+    size_t chunk;
+    size_t copied = 0;
+
+    while (copied < len)
+    {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, pos + copied, &entry_offset);
+        if (entry == NULL)
+            break;
+
+        chunk = min(entry->size - entry_offset, len - copied);
+        memcpy(dest + copied, entry->buffptr + entry_offset, chunk);
+        copied += chunk;
+    }
+}
+
+// AESDCHAR_IOCREADV: return several command ranges in one call.
+// Every descriptor is validated under one read lock acquisition, so a bad one copies nothing. The bytes then go
+// out through a bounce buffer of at most AESD_READV_CHUNK bytes, filled under the lock and copied to user space
+// after releasing it: neither a large buf_len nor a fault on the user buffer pins memory or holds off writers.
+// Ranges are tracked by stream offset between chunks; one evicted before it is copied ends short.
+static long aesd_read_ranges(struct aesd_dev *dev, struct aesd_readv __user *uarg)
+{
+    struct aesd_readv req;
+    struct aesd_read_desc *descs = NULL;
+    struct aesd_buffer_entry *entry = NULL;
+    uint64_t *starts = NULL;      // Stream offset of each range
+    uint64_t oldest_start;
+    size_t start_offset = 0;
+    size_t stored;
+    size_t filled;
+    size_t chunk;
+    size_t len;
+    uint64_t total = 0;
+    uint32_t done = 0;            // Bytes of range i already copied
+    char *bounce = NULL;
+    uint32_t i;
+    long retval = 0;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+    if (req.count == 0 || req.count > AESDCHAR_READV_MAX_DESCS || req.reserved != 0)
+        return -EINVAL;
+
+    // Descriptors are fetched before locking so no user page faults happen while writers wait
+    descs = memdup_user(u64_to_user_ptr(req.descs), req.count * sizeof(*descs));
+    if (IS_ERR(descs))
+        return PTR_ERR(descs);
+    starts = kmalloc_array(req.count, sizeof(*starts), GFP_KERNEL);
+    if (starts == NULL)
+    {
+        kfree(descs);
+        return -ENOMEM;
+    }
+
+    if (down_read_interruptible(&dev->lock))
+    {
+        kfree(starts);
+        kfree(descs);
+        return -ERESTARTSYS;
+    }
+
+    // Validate every range first, as AESDCHAR_IOCSEEKTO does.
+    // Each range gets what is stored from its start, up to its len and the room left in buf.
+    stored = aesd_circular_buffer_size(&dev->buffer);
+    oldest_start = aesd_oldest_start(dev);
+    for (i = 0; i < req.count; i++)
+    {
+        entry = aesd_circular_buffer_get_entry(&dev->buffer, descs[i].write_cmd, &start_offset);
+        if ((entry == NULL) || (descs[i].write_cmd_offset >= entry->size))
+        {
+            PDEBUG("Invaid write_cmd, write_cmd_offset values in descriptor %u\n", i);
+            up_read(&dev->lock);
+            retval = -EINVAL;
+            goto out_free;
+        }
+        start_offset += descs[i].write_cmd_offset;
+        starts[i] = oldest_start + start_offset;
+        descs[i].result = min3((uint64_t)descs[i].len, (uint64_t)(stored - start_offset), req.buf_len - total);
+        total += descs[i].result;
+    }
+    up_read(&dev->lock);
+
+    chunk = min_t(uint64_t, total, AESD_READV_CHUNK);
+    if (chunk > 0)
+    {
+        bounce = kvmalloc(chunk, GFP_KERNEL);
+        if (bounce == NULL)
+        {
+            retval = -ENOMEM;
+            goto out_free;
+        }
+    }
+
+    // Fill the bounce buffer from as many ranges as fit, drop the lock, copy it out; repeat
+    for (i = 0, total = 0; chunk > 0 && i < req.count; )
+    {
+        if (down_read_interruptible(&dev->lock))
+        {
+            retval = -ERESTARTSYS;
+            goto out_free;
+        }
+        oldest_start = aesd_oldest_start(dev);
+        for (filled = 0; i < req.count && filled < chunk; )
+        {
+            if (done < descs[i].result && starts[i] + done < oldest_start)
+                descs[i].result = done;    // Evicted since validation; the range ends here
+            if (done == descs[i].result)
+            {
+                i++;
+                done = 0;
+                continue;
+            }
+            len = min_t(size_t, descs[i].result - done, chunk - filled);
+            aesd_copy_range(dev, starts[i] + done - oldest_start, bounce + filled, len);
+            filled += len;
+            done += len;
+        }
+        up_read(&dev->lock);
+
+        if (copy_to_user(u64_to_user_ptr(req.buf) + total, bounce, filled))
+        {
+            retval = -EFAULT;
+            goto out_free;
+        }
+        total += filled;
+    }
+
+    req.total = total;
+    if (copy_to_user(u64_to_user_ptr(req.descs), descs, req.count * sizeof(*descs)) ||
+        copy_to_user(uarg, &req, sizeof(req)))
+        retval = -EFAULT;
+
+out_free:
+    kvfree(bounce);
+    kfree(starts);
+    kfree(descs);
+    return retval;
+}
+
+/*
+ * mmap mirror: a header page (struct aesd_mmap_header in aesd_ioctl.h) with a table of the newest entries,
+ * followed by a data ring holding their bytes. Kept in step with the circular buffer under dev->lock held for
+ * writing; user space checks header->seq to detect updates made while it was reading.
+ */
+static struct aesd_mmap_header *aesd_mmap_alloc(unsigned long data_size)
+{
+    struct aesd_mmap_header *hdr;
+
+    data_size = PAGE_ALIGN(data_size);
+    hdr = vmalloc_user(PAGE_SIZE + data_size);  // zeroed, and suitable for remap_vmalloc_range
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->magic = AESD_MMAP_MAGIC;
+    hdr->version = AESD_MMAP_VERSION;
+    hdr->max_entries = (PAGE_SIZE - sizeof(*hdr)) / sizeof(struct aesd_mmap_entry);
+    hdr->data_offset = PAGE_SIZE;
+    hdr->data_size = data_size;
+    return hdr;
+}
+
+static void aesd_mmap_begin(struct aesd_mmap_header *hdr)
+{
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+    smp_wmb();
+}
+
+static void aesd_mmap_end(struct aesd_mmap_header *hdr)
+{
+    smp_wmb();
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+// Drop mirrored entries that left the circular buffer or whose bytes were overwritten in the data ring
+static void aesd_mmap_trim(struct aesd_dev *dev)
+{
+    struct aesd_mmap_header *hdr = dev->mmap_area;
+    struct aesd_buffer_entry *oldest = aesd_circular_buffer_get_entry(&dev->buffer, 0, NULL);
+    uint64_t oldest_start = oldest ? oldest->start : dev->buffer.total_added;
+    struct aesd_mmap_entry *entry;
+
+    while (hdr->count > 0)
+    {
+        entry = &hdr->entries[hdr->first];
+        if (entry->start >= oldest_start && hdr->head - entry->start <= hdr->data_size)
+            break;
+        hdr->first = (hdr->first + 1) % hdr->max_entries;
+        hdr->count--;
+    }
+}
+
+// Mirror an entry just added to the circular buffer; an entry larger than the ring empties the mirror
+static void aesd_mmap_publish(struct aesd_dev *dev, const struct aesd_buffer_entry *added)
+{
+    struct aesd_mmap_header *hdr = dev->mmap_area;
+    char *ring;
+    size_t pos, first_part;
+
+    if (hdr == NULL)
+        return;
+
+    aesd_mmap_begin(hdr);
+    if (added->size <= hdr->data_size)
+    {
+        ring = (char *)hdr + hdr->data_offset;
+        pos = added->start % hdr->data_size;
+        first_part = min_t(size_t, added->size, hdr->data_size - pos);
+        memcpy(ring + pos, added->buffptr, first_part);
+        memcpy(ring, added->buffptr + first_part, added->size - first_part);
+
+        if (hdr->count == hdr->max_entries)
+        {
+            hdr->first = (hdr->first + 1) % hdr->max_entries;
+            hdr->count--;
+        }
+        hdr->entries[(hdr->first + hdr->count) % hdr->max_entries].start = added->start;
+        hdr->entries[(hdr->first + hdr->count) % hdr->max_entries].size = added->size;
+        hdr->count++;
+    }
+    hdr->head = added->start + added->size;
+    aesd_mmap_trim(dev);
+    aesd_mmap_end(hdr);
+}
+
+// Bring the mirror in line after entries were evicted without adding one
+static void aesd_mmap_sync(struct aesd_dev *dev)
+{
+    if (dev->mmap_area == NULL)
+        return;
+
+    aesd_mmap_begin(dev->mmap_area);
+    aesd_mmap_trim(dev);
+    aesd_mmap_end(dev->mmap_area);
+}
+
+// The mirror is allocated by the first mmap() of the device, and starts out with the commands already stored,
+// oldest first. Once set, dev->mmap_area does not change until the device is torn down.
+static int aesd_mmap_create(struct aesd_dev *dev)
+{
+    struct aesd_mmap_header *hdr;
+    size_t i;
+
+    if (smp_load_acquire(&dev->mmap_area) != NULL)
+        return 0;
+    if (mmap_size == 0)
+        return -ENODEV;
+
+    // vmalloc may sleep; allocate before taking the lock and drop it if another mmap() got there first
+    hdr = aesd_mmap_alloc(mmap_size);
+    if (hdr == NULL)
+        return -ENOMEM;
+
+    if (down_write_killable(&dev->lock))
+    {
+        vfree(hdr);
+        return -EINTR;
+    }
+    if (dev->mmap_area == NULL)
+    {
+        smp_store_release(&dev->mmap_area, hdr);
+        hdr = NULL;
+        for (i = 0; i < aesd_circular_buffer_count(&dev->buffer); i++)
+            aesd_mmap_publish(dev, aesd_circular_buffer_get_entry(&dev->buffer, i, NULL));
+    }
+    up_write(&dev->lock);
+
+    vfree(hdr);
+    return 0;
+}
+
+// Ref: https://www.kernel.org/doc/html/latest/core-api/mm-api.html#c.remap_vmalloc_range
+// Map the mirror read-only; the driver is its only writer
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_dev *dev = aesd_file_dev(filp);
+    int result;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EACCES;
+
+    result = aesd_mmap_create(dev);
+    if (result)
+        return result;
+
+    // Keep mprotect() from making it writable later
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    // Fails with -EINVAL if the requested range runs past the end of the mirror
+    return remap_vmalloc_range(vma, dev->mmap_area, vma->vm_pgoff);
+}
+
+// Resize the circular buffer to new_capacity entries, keeping the newest ones.
+// The new array is allocated before taking the lock so writers and readers are only held off for the copy.
+static long aesd_resize_buffer(struct aesd_dev *dev, uint32_t new_capacity)
+{
+    struct aesd_buffer_entry *storage = NULL;
+    struct aesd_buffer_entry *old_storage = NULL;
+
+    if (new_capacity == 0 || new_capacity > AESDCHAR_MAX_ENTRIES_LIMIT)
+        return -EINVAL;
+
+    storage = kvcalloc(new_capacity, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+    if (storage == NULL)
+        return -ENOMEM;
+
+    if (down_write_killable(&dev->lock))
+    {
+        kvfree(storage);
+        return -EINTR;
+    }
+
+    // Drop the oldest entries that no longer fit; readers see them age out exactly as if new writes had evicted them
+    while (aesd_circular_buffer_count(&dev->buffer) > new_capacity)
+        aesd_evict_oldest(dev);
+    aesd_mmap_sync(dev);
+
+    old_storage = aesd_circular_buffer_relocate(&dev->buffer, storage, new_capacity);
+
+    up_write(&dev->lock);
+
+    if (old_storage != dev->buffer.default_entry)
+        kvfree(old_storage);
+
+    PDEBUG("resized buffer to %u entries\n", new_capacity);
+    return 0;
+}
+
 // Ref: Assignment-9-overview lecture slides
 // Ref: https://lwn.net/Articles/119652/
 //long (*unlocked_ioctl) (struct file *filp, unsigned int cmd, unsigned long arg);
@@ -219,6 +742,7 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
     ssize_t retval = 0;
     struct aesd_seekto seekto;
+    uint32_t new_capacity;
     
     // Check input parameters validity first
     // filp - file pointer private_data member used to get aesd_dev
@@ -233,9 +757,9 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     
     // Ref: Assignment-9-overview lecture slide 17
 
-    //switch (cmd)
+    switch (cmd)
 	{
-		//case AESDCHAR_IOCSEEKTO:
+		case AESDCHAR_IOCSEEKTO:
     		if(copy_from_user(&seekto, (const void __user *) arg, sizeof(seekto)) != 0)
     		{
         		retval = -EFAULT;
@@ -244,12 +768,27 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     		{
         		retval = aesd_adjust_file_offset(filp, seekto.write_cmd, seekto.write_cmd_offset);
     		}
-    		//break;
+    		break;
+
+		case AESDCHAR_IOCRESIZE:
+    		if(copy_from_user(&new_capacity, (const void __user *) arg, sizeof(new_capacity)) != 0)
+    		{
+        		retval = -EFAULT;
+    		}
+    		else
+    		{
+        		retval = aesd_resize_buffer(aesd_file_dev(filp), new_capacity);
+    		}
+    		break;
+
+		case AESDCHAR_IOCREADV:
+    		retval = aesd_read_ranges(aesd_file_dev(filp), (struct aesd_readv __user *) arg);
+    		break;
     		
-    	//default:
-    		//PDEBUG("Invalid\n");
-    		//retval = -ENOTTY;
-    		//break;
+    	default:
+    		PDEBUG("Invalid\n");
+    		retval = -ENOTTY;
+    		break;
     }
     
     PDEBUG("ioctl success!\n");
@@ -269,104 +808,131 @@ Steps to read data from kernel space to user space buf
 6. Copy to user space buf with error handling
 7. Update f_pos to point to next offset
 8. Retval set to complete/ partial read bytes
-9. Unlock and exit
+9. Repeat from 4 with the next entry until the user buffer is full or no data is left
+10. Unlock and exit
 
 */
 // Read data from CB of device considering partial read, EOF and errors.
+// Implemented as read_iter, so read(2), readv(2), io_uring and splice all copy as many entries as fit in one call.
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
 	int rc; // return code storage variable
     ssize_t retval = 0;
     struct aesd_dev *dev = NULL;
+    struct aesd_file *file = NULL;
+    loff_t pos;
+    uint64_t oldest_start;
+    unsigned long commits_seen;
+    bool sequential;
     
     size_t entry_offset_byte_rtn = 0; // contains offset
 	struct aesd_buffer_entry *data_entry = NULL; // initialize to get data entry in CB
 	
 	size_t bytes_to_read_in_entry = 0;
     size_t bytes_can_be_read = 0;
-    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
+    size_t bytes_copied = 0;
+    size_t requested;
+    u64 start_ns;
     /**
      * TODO: handle read
      */
      
     // Check input parameters validity first
-    // filp - file pointer private_data member used to get aesd_dev
-    // buf - buffer to fill
-    // f_pos - pointer to the read offset; references loc in virtual device (specific byte of CB linear content)
-    if(filp == NULL || buf == NULL || f_pos == NULL)
+    // iocb - carries the file pointer and the read offset ki_pos; references loc in virtual device (specific byte of CB linear content)
+    // to - user buffer(s) to fill; its count is the max number of bytes to read
+    if(iocb == NULL || iocb->ki_filp == NULL || to == NULL)
     {
     	PDEBUG("Input parameters of read function invalid; memory access failure\n");
         return -EFAULT; // mem access failure error code
     }
+    pos = iocb->ki_pos;
+    PDEBUG("read %zu bytes with offset %lld",iov_iter_count(to),pos);
     
     // Check input parameters validity first
-    // count - max number of bytes to write to buff; may want/need to write less than this
-	if (count == 0)
+    // count - max number of bytes to read; may want/need to read less than this
+	if (iov_iter_count(to) == 0)
 	{
-		PDEBUG("No data to write; return success\n");
+		PDEBUG("No data to read; return success\n");
 		return 0;
 	}
 		
 	// file pointer filp private_data used to get aesd_dev
-	dev = filp->private_data;
-	
+	file = iocb->ki_filp->private_data;
+	dev = file->dev;
+	requested = iov_iter_count(to);
+	// read(2) hands us a copy of f_pos; pread(2) and friends pass their own offset and leave f_pos alone
+	sequential = pos == READ_ONCE(iocb->ki_filp->f_pos);
+
+retry:
+	// Only read the clock when someone is listening; the tracepoint itself is a no-op branch otherwise
+	start_ns = trace_aesd_read_enabled() ? ktime_get_ns() : 0;
+
 	// Lock for safe multi-threaded op
-	rc = mutex_lock_interruptible(&dev->lock); //  check in rc if lock acquisition interrupted by a signal
+	rc = down_read_interruptible(&dev->lock); //  shared with other readers; check in rc if lock acquisition interrupted by a signal
 	if (rc != SUCCESS)
 	{
 		PDEBUG("Lock failure in read;  lock acquisition was interrupted by a signal");
 		return -ERESTARTSYS;  //restart syscall code
 	}
+
+	oldest_start = aesd_oldest_start(dev);
+	pos = aesd_rebase_pos(file, sequential, pos, oldest_start);
 	
+	while (iov_iter_count(to) > 0)
+	{
+		// From aesd-circular-buffer.h 
+		// struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer, size_t char_offset, size_t *entry_offset_byte_rtn );
+		data_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, pos, &entry_offset_byte_rtn);
+		
+		// Check if entry doesn't exist; end of the buffer
+	    if(data_entry == NULL)
+	        break;
+	    
+	    bytes_to_read_in_entry = data_entry->size - entry_offset_byte_rtn;
+	    
+	    // If bytes to read exceeds space left in the user buffer, can only read till count; considering partial read possibility
+	    bytes_can_be_read = min(bytes_to_read_in_entry, iov_iter_count(to));
+	    
+	    // use copy_to_iter to fill the user buffer(s) from kernel space, as we cannot access them directly
+	    // Ref: https://www.kernel.org/doc/html/latest/core-api/kernel-api.html#c.copy_to_iter
+	    // size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+	    bytes_copied = copy_to_iter(data_entry->buffptr + entry_offset_byte_rtn, bytes_can_be_read, to);
+	    retval += bytes_copied;
+	    pos += bytes_copied;
+	    
+	    if (bytes_copied < bytes_can_be_read)
+	    {
+	        PDEBUG("Failed to copy to user space buf");
+	        if (retval == 0)
+	            retval = -EFAULT;
+	        break;
+	    }
+	}
 	
-	// From aesd-circular-buffer.h 
-	// struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer, size_t char_offset, size_t *entry_offset_byte_rtn );
-	data_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &entry_offset_byte_rtn);
-	
-	// Check if entry doesn't exist
-    if(data_entry == NULL)
-    {
-        PDEBUG("No data to read; exit");
-        mutex_unlock(&dev->lock);  // unlock mutex
-        return retval;             // return
-    }
-    
-    bytes_to_read_in_entry = data_entry->size - entry_offset_byte_rtn;
-    bytes_can_be_read = 0;
-    
-    // If bytes to read exceeds max allowed count, can only read till count; considering partial read possibility
-    if (bytes_to_read_in_entry > count)
-    {
-    	PDEBUG("Partial read!\n");
-    	bytes_can_be_read = count;
-    }
-    else
-    {
-        // Considering complete read possible
-     	PDEBUG("Complete read!\n");
-    	bytes_can_be_read = bytes_to_read_in_entry;   	
-    }
-    
-    // use copy_to_user to fill buf from kernel to user space, as we cannot access buf directly
-    // Ref: https://manpages.org/__copy_to_user/9
-    // copy_to_user(void __user * to, const void * from, unsigned long n);
-    // buf = Destination address, in user space.
-    // data_entry->buffptr + entry_offset_byte_rtn = Source address, in kernel space.(starting pt within buffer to copy from)
-    // bytes_can_be_read = Number of bytes to copy.
-    rc = copy_to_user(buf, data_entry->buffptr + entry_offset_byte_rtn, bytes_can_be_read);
-    if (rc)
+	if (retval >= 0)
+	{
+		iocb->ki_pos = pos;            // update f_pos to point to next offset
+		// A file only ever read with pread(2) keeps f_pos at 0, so a read ending at 0 is not recorded: a
+		// later pread at offset 0 would look like a continuation of it
+		if (sequential)
+			aesd_save_read_pos(file, pos > 0 ? pos : -1, oldest_start + pos);
+	}
+	commits_seen = dev->commits;
+     
+    up_read(&dev->lock); // unlock semaphore 
+
+    // At the end of the buffer: optionally wait for the next command rather than report EOF
+    if (retval == 0 && blocking_read && !(iocb->ki_filp->f_flags & O_NONBLOCK) && !(iocb->ki_flags & IOCB_NOWAIT))
     {
-        PDEBUG("Failed to copy to user space buf; exit");
-        mutex_unlock(&dev->lock);  // unlock mutex
-        return -EFAULT;             // return    	
+        if (wait_event_interruptible(dev->readq, READ_ONCE(dev->commits) != commits_seen))
+            return -ERESTARTSYS;
+        goto retry;
     }
-    
-    retval = bytes_can_be_read;  // bytes read stored in retval depending on complete/ partial read
-	*f_pos += retval;            // update f_pos to point to next offset
-     
+
+    trace_aesd_read(MINOR(dev->cdev.dev), iocb->ki_pos, requested, retval,
+                    start_ns ? ktime_get_ns() - start_ns : 0);
     PDEBUG("Read success!");
-    mutex_unlock(&dev->lock);  // unlock mutex 
     return retval;
 }
 
@@ -377,6 +943,11 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff
     char *newline_ptr = NULL;
     ssize_t retval = -ENOMEM;
     struct aesd_dev *dev = NULL;
+    struct aesd_file *file = NULL;
+    char *pending = NULL;      // Buffer the new bytes are copied into; the pending entry, or its grown replacement
+    size_t new_capacity = 0;
+    bool committed = false;
+    u64 start_ns;
     	int rc; // return code storage variable
     	
     PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
@@ -402,103 +973,152 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff
 	}
 		
 	// file pointer filp private_data used to get aesd_dev
-	dev = filp->private_data;
-	
-	// Allocate mem to store write data from user space onto kernel space
-	// Ref: https://manpages.org/kmalloc/9
-	// void * kmalloc(size_t size, gfp_t flags);
-	char *write_data_uspace = kmalloc(count, GFP_KERNEL); //GFP_KERNEL - Allocate normal kernel ram. May sleep.
-	if (write_data_uspace == NULL)
-	{
-		PDEBUG("Kmalloc failure!\n");
-	    mutex_unlock(&dev->lock);  // unlock mutex 
-        return retval;		
-	}
-
+	file = filp->private_data;
+	dev = file->dev;
+	start_ns = trace_aesd_write_enabled() ? ktime_get_ns() : 0;
 	
-	// Lock for safe multi-threaded op
-	rc = mutex_lock_interruptible(&dev->lock); //  check in rc if lock acquisition interrupted by a signal
+	// Each open file assembles its own line, so partial writes through different files never interleave.
+	// The pending entry has its own lock, so user pages are faulted in without holding off readers
+	rc = mutex_lock_interruptible(&file->write_lock);
 	if (rc != SUCCESS)
 	{
 		PDEBUG("Lock failure in write;  lock acquisition was interrupted by a signal");
 		return -ERESTARTSYS;  //restart syscall code
-	}	
-	
-	// use copy_from_user to fill buf from user to kernel spce, as we cannot access buf directly
+	}
+
+	if (file->write_entry.size == 0 && READ_ONCE(dev->orphan_entry.size) != 0)
+		aesd_adopt_partial_line(dev, file);
+
+	// Grow the pending entry geometrically so a line arriving in many small writes is moved O(1) times per byte.
+	// The old contents are only released once the user copy has succeeded, so a fault leaves the entry as it was.
+	pending = (char *)file->write_entry.buffptr;
+	if (file->write_entry.size + count > file->write_capacity)
+	{
+		new_capacity = max3(file->write_entry.size + count, 2 * file->write_capacity, (size_t)AESD_LINE_CACHE_SIZE);
+		pending = aesd_line_alloc(dev, new_capacity);
+		if (pending == NULL)
+		{
+			PDEBUG("K Alloc failure!\n");
+			mutex_unlock(&file->write_lock);
+			return retval;
+		}
+		// Ref: https://www.man7.org/linux/man-pages/man3/memcpy.3.html
+		if (file->write_entry.size)
+			memcpy(pending, file->write_entry.buffptr, file->write_entry.size);
+	}
+
+	// use copy_from_user to append straight to the pending entry, as we cannot access buf directly
     // Ref: https://manpages.debian.org/testing/linux-manual-4.8/__copy_from_user.9.en.html
     // copy_from_user(void __user * to, const void * from, unsigned long n);
-    // write_data_uspace = Destination address, in kernel space.
-    // buf = Source address, in user space
-    // count = Number of bytes to copy.
-    rc = copy_from_user(write_data_uspace, buf, count);
+    rc = copy_from_user(pending + file->write_entry.size, buf, count);
     if (rc)
     {
         PDEBUG("Failed to copy from user space buf; exit");
-        mutex_unlock(&dev->lock);  // unlock mutex
-        kfree(write_data_uspace);
+        if (pending != file->write_entry.buffptr)
+            aesd_line_free(dev, pending, new_capacity);
+        mutex_unlock(&file->write_lock);
         return -EFAULT;             // return    	
-    }   
-    
-    // Check if CB empty
-	if (dev->write_entry.size == 0)
-	{
-		dev->write_entry.buffptr = kmalloc(count,GFP_KERNEL);
-	}
-	else // if not reallocate mem
-	{
-	    // Ref: https://manpages.org/krealloc/9
-    	// void * krealloc(const void * p, size_t new_size, gfp_t flags);
-    	// dev->write_entry.buffptr = obj to reallocate mem for
-    	// dev->write_entry.size + count = new size
-    	// flag = GFP_KERNEL (Allocate normal kernel ram. May sleep.)
-		dev->write_entry.buffptr = krealloc(dev->write_entry.buffptr, dev->write_entry.size + count, GFP_KERNEL);
-	}
-		
-	// Check mem alloc failure
-	if (dev->write_entry.buffptr == NULL)
-	{ 
-	    PDEBUG("K Alloc failure!\n");
-	    mutex_unlock(&dev->lock);  // unlock mutex 
-	    kfree(write_data_uspace);
-        return retval;
-	}
-	
-	// copy data to write entry, most recent, append
-	// Ref: https://www.man7.org/linux/man-pages/man3/memcpy.3.html
-	// void *memcpy(dest, src, n)
-    memcpy((void *)dev->write_entry.buffptr + dev->write_entry.size, write_data_uspace, count);
-    dev->write_entry.size += count;
+    }
+
+    if (pending != file->write_entry.buffptr)
+    {
+        aesd_line_free(dev, file->write_entry.buffptr, file->write_capacity);
+        file->write_entry.buffptr = pending;
+        file->write_capacity = new_capacity;
+    }
+    file->write_entry.size += count;
+    retval = count;
     
     // Check new line char
     // Ref: https://www.man7.org/linux/man-pages/man3/memchr.3.html
-    // Scan mem for '\n' char
-    newline_ptr = memchr(write_data_uspace, '\n', count);
+    // Scan the bytes just copied for '\n' char
+    newline_ptr = memchr(pending + file->write_entry.size - count, '\n', count);
     if(newline_ptr != NULL)  // Found '\n'
     {
+        // Both failures below hand the bytes back: reporting them written while the '\n' stays pending would
+        // make the next write continue this line instead of starting a new one
+        if (!aesd_fit_line(dev, file))
+        {
+            PDEBUG("K Alloc failure!\n");
+            file->write_entry.size -= count;
+            mutex_unlock(&file->write_lock);
+            return -ENOMEM;
+        }
+
+    	// Lock for safe multi-threaded op
+    	rc = down_write_killable(&dev->lock); //  exclusive; check in rc if lock acquisition interrupted by a fatal signal
+    	if (rc != SUCCESS)
+    	{
+    		PDEBUG("Lock failure in write;  lock acquisition was interrupted by a signal");
+    		file->write_entry.size -= count;
+    		mutex_unlock(&file->write_lock);
+    		return -EINTR;
+    	}
+
+        // Make room: byte budget first, then the count limit, so add_entry never overwrites an entry itself
+        while (aesd_circular_buffer_over_budget(&dev->buffer, file->write_entry.size) ||
+               aesd_circular_buffer_count(&dev->buffer) == dev->buffer.capacity)
+            aesd_evict_oldest(dev);
+
         // add to CB(buffer, entry)
-        const char* return_entry = aesd_circular_buffer_add_entry(&dev->buffer, &dev->write_entry);
-        if(return_entry != NULL)  
-    		kfree(return_entry); // free overwritten if failure
+        aesd_circular_buffer_add_entry(&dev->buffer, &file->write_entry);
+        trace_aesd_add_entry(MINOR(dev->cdev.dev), file->write_entry.size,
+                             aesd_circular_buffer_count(&dev->buffer), aesd_circular_buffer_size(&dev->buffer));
+        aesd_mmap_publish(dev, aesd_circular_buffer_get_entry(&dev->buffer,
+                          aesd_circular_buffer_count(&dev->buffer) - 1, NULL));
+        WRITE_ONCE(dev->commits, dev->commits + 1);
+        up_write(&dev->lock); // unlock semaphore 
+
+        // Ref: https://www.kernel.org/doc/html/latest/driver-api/basics.html#c.wake_up_interruptible
+        wake_up_interruptible(&dev->readq);
 
-        // clear current
-        dev->write_entry.buffptr = NULL;
-        dev->write_entry.size = 0;
+        // clear current; the buffer now owns the line
+        file->write_entry.buffptr = NULL;
+        file->write_entry.size = 0;
+        file->write_capacity = 0;
+        committed = true;
     }
-    
-    retval = count;
 	
     PDEBUG("Write success!");
-    mutex_unlock(&dev->lock);  // unlock mutex 
-    kfree(write_data_uspace);
+    mutex_unlock(&file->write_lock);
+    trace_aesd_write(MINOR(dev->cdev.dev), count, retval, committed, start_ns ? ktime_get_ns() - start_ns : 0);
     
     *f_pos += retval; // advance the pointer by the number of bytes written
     
     return retval;
 }
 
+// Ref: https://www.kernel.org/doc/html/latest/filesystems/vfs.html#struct-file-operations
+// Readable when a read from the current file position would return data; always writable
+static __poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+    loff_t pos;
+
+    poll_wait(filp, &dev->readq, wait);
+
+    down_read(&dev->lock);
+    pos = aesd_rebase_pos(file, true, filp->f_pos, aesd_oldest_start(dev));
+    if (pos < aesd_circular_buffer_size(&dev->buffer))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    up_read(&dev->lock);
+
+    return mask;
+}
+
+// splice(2) from the device goes through aesd_read_iter
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define aesd_splice_read copy_splice_read
+#else
+#define aesd_splice_read generic_file_splice_read
+#endif
+
 struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
-    .read =     aesd_read,
+    .read_iter =    aesd_read_iter,
+    .splice_read =  aesd_splice_read,
     .write =    aesd_write,
     .open =     aesd_open,
     .release =  aesd_release,
@@ -506,48 +1126,133 @@ struct file_operations aesd_fops = {
     // Added for A9
     .llseek         = aesd_llseek,
     .unlocked_ioctl = aesd_ioctl,
+    .mmap           = aesd_mmap,
+    .poll           = aesd_poll,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+// Set up one device with its own buffer, locks and slab cache; the cdev goes live last. The mmap mirror waits
+// for the first mmap().
+static int aesd_setup_device(struct aesd_dev *dev, unsigned int index)
+{
+    struct aesd_buffer_entry *storage = NULL;
+    int result;
+
+	init_rwsem(&dev->lock);
+	mutex_init(&dev->orphan_lock);
+	init_waitqueue_head(&dev->readq);
+
+    // Ref: https://www.kernel.org/doc/html/latest/core-api/mm-api.html#c.kmem_cache_create
+    snprintf(dev->line_cache_name, sizeof(dev->line_cache_name), "aesdchar%u_line", index);
+    dev->line_cache = kmem_cache_create(dev->line_cache_name, AESD_LINE_CACHE_SIZE, 0, 0, NULL);
+    if (dev->line_cache == NULL)
+        return -ENOMEM;
+
+    storage = kvcalloc(max_entries, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+    if (storage == NULL) {
+        kmem_cache_destroy(dev->line_cache);
+        return -ENOMEM;
+    }
+    aesd_circular_buffer_init_storage(&dev->buffer, storage, max_entries);
+    dev->buffer.max_bytes = max_bytes;
+
+    result = aesd_setup_cdev(dev, index);
+    if( result ) {
+        kvfree(storage);
+        kmem_cache_destroy(dev->line_cache);
+    }
+    return result;
+}
+
+static void aesd_teardown_device(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *entryptr = NULL;
+    unsigned int index = 0;
+
+    cdev_del(&dev->cdev);
 
+    /**
+     * TODO: cleanup AESD specific poritions here as necessary
+     */
+     /*
+    #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
+    for(index=0, entryptr=&((buffer)->entry[index]); \
+            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index++, entryptr=&((buffer)->entry[index]))*/
+            
+    AESD_CIRCULAR_BUFFER_FOREACH(entryptr,&dev->buffer,index) 
+    {
+        aesd_line_free(dev, entryptr->buffptr, entryptr->size);
+        entryptr->buffptr = NULL;
+        entryptr->size = 0;
+    }
+    if (dev->buffer.entry != dev->buffer.default_entry)
+        kvfree(dev->buffer.entry);
+
+    // Partial line left by a closed file and never terminated by '\n'
+    aesd_line_free(dev, dev->orphan_entry.buffptr, dev->orphan_capacity);
+    kmem_cache_destroy(dev->line_cache);
+    vfree(dev->mmap_area);
+    mutex_destroy(&dev->orphan_lock);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int index;
+
+    if (num_devices == 0 || num_devices > AESDCHAR_MAX_DEVICES) {
+        printk(KERN_WARNING "aesdchar: num_devices %u out of range, using 1\n", num_devices);
+        num_devices = 1;
+    }
+    if (max_entries == 0 || max_entries > AESDCHAR_MAX_ENTRIES_LIMIT) {
+        printk(KERN_WARNING "aesdchar: max_entries %u out of range, using %d\n", max_entries,
+               AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+        max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+
+    result = alloc_chrdev_region(&dev, aesd_minor, num_devices,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
 
     /**
      * TODO: initialize the AESD specific portion of the device
      */
-     
-	mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
+    aesd_devices = kcalloc(num_devices, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (aesd_devices == NULL) {
+        unregister_chrdev_region(dev, num_devices);
+        return -ENOMEM;
+    }
 
-    result = aesd_setup_cdev(&aesd_device);
+    for (index = 0; index < num_devices; index++) {
+        result = aesd_setup_device(&aesd_devices[index], index);
+        if (result)
+            break;
+    }
 
     if( result ) {
-        unregister_chrdev_region(dev, 1);
+        while (index-- > 0)
+            aesd_teardown_device(&aesd_devices[index]);
+        kfree(aesd_devices);
+        unregister_chrdev_region(dev, num_devices);
     }
     return result;
 
@@ -555,31 +1260,15 @@ int aesd_init_module(void)
 
 void aesd_cleanup_module(void)
 {
-    struct aesd_buffer_entry *entryptr = NULL;
-    int index = 0;
+    unsigned int index;
     
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-    cdev_del(&aesd_device.cdev);
-
-    /**
-     * TODO: cleanup AESD specific poritions here as necessary
-     */
-     /*
-    #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
-    for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
-            index++, entryptr=&((buffer)->entry[index]))*/
-            
-    AESD_CIRCULAR_BUFFER_FOREACH(entryptr,&aesd_device.buffer,index) 
-    {
-        kfree(entryptr->buffptr);
-        entryptr->buffptr = NULL;
-        entryptr->size = 0;
-    }
-	mutex_destroy(&aesd_device.lock);
+    for (index = 0; index < num_devices; index++)
+        aesd_teardown_device(&aesd_devices[index]);
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, num_devices);
 }
 
 
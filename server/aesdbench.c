@@ -0,0 +1,545 @@
+/*
+ * Filename   : aesdbench.c
+ *
+ * Description: Load generator and latency benchmark for aesdsocket.
+ *            : Opens -c connections to the server, each in its own thread, and sends lines of -s bytes (or a
+ *            : random size in min-max) for -t seconds, optionally paced at -r lines per second per connection.
+ *            : -k makes that percentage of the requests AESDCHAR_IOCSEEKTO:<cmd>,<offset> commands.
+ *            :
+ *            : Every line is "bench <run> <conn> <seq> <payload>\n" with a payload derived from conn and seq,
+ *            : so any bench line in a reply can be checked byte for byte. A request is complete when the
+ *            : connection's own line comes back: the server answers a line with DATA_FILE up to and including
+ *            : it. A seek is followed by a marker line on the same connection, because its reply (the data
+ *            : from the seek position, or nothing when the ioctl fails, e.g. against a regular DATA_FILE) has
+ *            : no end the client can see; the seek latency covers both replies.
+ *            :
+ *            : Checks: bench payloads intact, own lines in increasing order within a reply, every request
+ *            : answered within the receive timeout. Reports requests/s, MB/s both ways and p50/p99/p999/max
+ *            : latency, measured from the time a paced request was due so a stalled server is not hidden.
+ *            :
+ *            : With a regular DATA_FILE (aesdsocket built with make USE_AESD_CHAR_DEVICE=0) every reply is the
+ *            : whole file, so reply sizes grow with the run; start the server on an empty file and keep -t short
+ *            : to compare runs.
+ *
+ * Usage      : aesdbench [-H host] [-p port] [-c connections] [-t seconds] [-s size|min-max] [-r rate] [-k percent]
+ *
+ * Author     : Swathi Venkatachalam
+ *
+ * Reference  : [1] pthread_create - https://www.man7.org/linux/man-pages/man3/pthread_create.3.html
+ *            : [2] clock_gettime  - https://www.man7.org/linux/man-pages/man2/clock_gettime.2.html
+ *            : [3] getaddrinfo    - https://man7.org/linux/man-pages/man3/getaddrinfo.3.html
+ *            : [4] setsockopt     - https://www.man7.org/linux/man-pages/man7/socket.7.html (SO_RCVTIMEO)
+ *            : [5] clock_nanosleep - https://www.man7.org/linux/man-pages/man2/clock_nanosleep.2.html
+ *            : [6] qsort          - https://www.man7.org/linux/man-pages/man3/qsort.3.html
+ */
+
+/*************************************************************************
+ *                            Header Files                               *
+ *************************************************************************/
+
+#include <stdio.h>                               // Standard input output library
+#include <stddef.h>                              // offsetof
+#include <stdlib.h>                              // General purpose utility functions
+#include <string.h>                              // String manipulations
+#include <stdbool.h>                             // bool
+#include <stdint.h>                              // uint64_t
+#include <stdatomic.h>                           // atomic_bool stop flag
+#include <unistd.h>                              // POSIX API; close, getopt
+#include <pthread.h>                             // POSIX threads library
+#include <time.h>                                // clock_gettime, clock_nanosleep
+#include <errno.h>                               // errno
+#include <sys/types.h>                           // Data types used in system calls
+#include <sys/socket.h>                          // Socket programming
+#include <netinet/in.h>                          // IPPROTO_TCP
+#include <netinet/tcp.h>                         // TCP_NODELAY
+#include <netdb.h>                               // getaddrinfo
+
+/*************************************************************************
+ *                            Macros                                     *
+ *************************************************************************/
+
+#define SUCCESS                           (0)
+#define FAILURE                           (1)
+
+#define DEFAULT_HOST                      ("127.0.0.1")
+#define DEFAULT_PORT                      ("9000")
+#define DEFAULT_CONNECTIONS               (8)
+#define DEFAULT_SECONDS                   (5)
+#define DEFAULT_LINE_SIZE                 (64)
+#define MIN_LINE_SIZE                     (40)           // Room for the "bench <run> <conn> <seq> " header
+#define MAX_LINE_SIZE                     (1024 * 1024)
+#define RECV_TIMEOUT_SECONDS              (5)
+#define RECV_BUFFER_SIZE                  (64 * 1024)
+#define SEEK_MAX_CMD                      (10)           // AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+#define NSEC_PER_SEC                      (1000000000ULL)
+
+/*************************************************************************
+ *                        Structures                                     *
+ *************************************************************************/
+
+// Latency samples in nanoseconds, grown as needed
+struct samples
+{
+    uint64_t *ns;
+    size_t len;
+    size_t capacity;
+};
+
+struct conn_result
+{
+    pthread_t thread_id;
+    unsigned int conn;                          // Connection number, part of every line it sends
+    unsigned long long lines;                   // Data line requests completed
+    unsigned long long seeks;                   // Seek requests completed
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    unsigned long long bad_lines;               // Bench lines with a corrupt payload or out of order
+    struct samples line_latency;
+    struct samples seek_latency;
+    const char *error;                          // Why the connection stopped early, NULL if it ran to the end
+};
+
+// Receive side of one connection: bytes received but not yet split into lines
+struct line_reader
+{
+    char *buffer;
+    size_t len;
+    size_t capacity;
+};
+
+/*************************************************************************
+ *                  Global Variables                                     *
+ *************************************************************************/
+
+const char *host = DEFAULT_HOST;
+const char *port = DEFAULT_PORT;
+unsigned int min_size = DEFAULT_LINE_SIZE, max_size = DEFAULT_LINE_SIZE;
+double rate = 0;                                // Requests per second per connection, 0 for back to back
+int seek_percent = 0;
+unsigned int run_id;                            // Tells this run's lines apart from older ones in DATA_FILE
+atomic_bool stop_flag;                          // Set by main when the measurement window ends
+
+/*************************************************************************
+ *                        Helper Functions                               *
+ *************************************************************************/
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    // Ref: [2] man page
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+bool samples_add(struct samples *s, uint64_t ns)
+{
+    uint64_t *grown;
+
+    if (s->len == s->capacity)
+    {
+        s->capacity = s->capacity ? 2 * s->capacity : 4096;
+        grown = realloc(s->ns, s->capacity * sizeof(*s->ns));
+        if (grown == NULL)
+            return false;
+        s->ns = grown;
+    }
+    s->ns[s->len++] = ns;
+    return true;
+}
+
+// Payload byte i of line seq on connection conn; the same for every run so old lines still check out
+char payload_byte(unsigned int conn, unsigned long long seq, size_t i)
+{
+    return 'a' + (conn * 7 + seq + i) % 26;
+}
+
+// Builds line seq of connection conn, size bytes long including its newline; returns the length
+size_t make_line(char *line, size_t size, unsigned int conn, unsigned long long seq)
+{
+    size_t len = snprintf(line, size, "bench %08x %u %llu ", run_id, conn, seq);
+    size_t i;
+
+    for (i = 0; len + 1 < size; i++, len++)
+        line[len] = payload_byte(conn, seq, i);
+    line[len++] = '\n';
+    return len;
+}
+
+// Checks one received line, NUL terminated in place of its newline. Returns true and fills conn and seq if it is a bench line
+// of this run; counts a bench line of any run whose payload does not match in bad_lines.
+bool check_line(struct conn_result *result, const char *line, size_t len, unsigned int *conn,
+                unsigned long long *seq)
+{
+    unsigned int line_run;
+    size_t i;
+    int header;
+
+    if (len < 6 || memcmp(line, "bench ", 6) != 0)
+        return false;                                                 // Timestamps, other clients
+    if (sscanf(line, "bench %8x %u %llu %n", &line_run, conn, seq, &header) != 3 || (size_t)header > len)
+    {
+        result->bad_lines++;
+        return false;
+    }
+    for (i = header; i < len; i++)
+    {
+        if (line[i] != payload_byte(*conn, *seq, i - header))
+        {
+            result->bad_lines++;
+            return false;
+        }
+    }
+    return line_run == run_id;
+}
+
+// Reads until the line own_line (without its newline) arrives, checking every complete line on the way.
+// Own lines of this connection must appear in increasing order, unless check_order is false.
+// Returns NULL on success or a description of the failure.
+const char *await_line(int fd, struct conn_result *result, struct line_reader *reader, unsigned long long own_seq,
+                       bool check_order)
+{
+    long long last_seq = -1;
+    unsigned long long seq;
+    unsigned int conn;
+    char *line, *newline;
+    ssize_t received;
+    size_t used;
+
+    for (;;)
+    {
+        // Complete lines first; the partial one at the end stays in the buffer
+        line = reader->buffer;
+        while ((newline = memchr(line, '\n', reader->buffer + reader->len - line)) != NULL)
+        {
+            bool own;
+
+            *newline = '\0';
+            own = check_line(result, line, newline - line, &conn, &seq) && conn == result->conn;
+
+            line = newline + 1;
+            if (!own)
+                continue;
+            if (check_order && (long long)seq <= last_seq)
+                result->bad_lines++;
+            last_seq = seq;
+            if (seq == own_seq)
+            {
+                // Whatever follows belongs to the same reply and is skipped by the next call
+                used = line - reader->buffer;
+                memmove(reader->buffer, line, reader->len - used);
+                reader->len -= used;
+                return NULL;
+            }
+        }
+        used = line - reader->buffer;
+        memmove(reader->buffer, line, reader->len - used);
+        reader->len -= used;
+
+        if (reader->capacity - reader->len < RECV_BUFFER_SIZE)
+        {
+            char *grown = realloc(reader->buffer, reader->capacity + RECV_BUFFER_SIZE);
+            if (grown == NULL)
+                return "out of memory";
+            reader->buffer = grown;
+            reader->capacity += RECV_BUFFER_SIZE;
+        }
+        received = recv(fd, reader->buffer + reader->len, reader->capacity - reader->len, 0);
+        if (received == 0)
+            return "connection closed by the server";
+        if (received == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? "reply timed out" : "recv failed";
+        result->bytes_received += received;
+        reader->len += received;
+    }
+}
+
+bool send_all(int fd, const char *data, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+int connect_server(void)
+{
+    struct addrinfo hints, *res, *p;
+    struct timeval timeout = { RECV_TIMEOUT_SECONDS, 0 };
+    int fd = -1, one = 1;
+
+    // Ref: [3] man page
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+
+    for (p = res; p != NULL; p = p->ai_next)
+    {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1)
+        return -1;
+
+    // Ref: [4] man page
+    // Requests are small and answered one at a time; don't let Nagle hold them back
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/*************************************************************************
+ *                        Thread Functions                               *
+ *************************************************************************/
+
+void *connection_thread(void *arg)
+{
+    struct conn_result *result = arg;
+    struct line_reader reader = { NULL, 0, 0 };
+    unsigned int seed = result->conn * 2654435761u ^ run_id;
+    uint64_t interval = rate > 0 ? (uint64_t)(NSEC_PER_SEC / rate) : 0;
+    uint64_t due = now_ns(), start, end;
+    unsigned long long seq = 0;
+    size_t size, len;
+    char *line;
+    bool seek;
+    int fd;
+
+    line = malloc(max_size + 64);
+    fd = connect_server();
+    if (line == NULL || fd == -1)
+    {
+        result->error = line == NULL ? "out of memory" : "connect failed";
+        free(line);
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed))
+    {
+        if (interval)
+        {
+            // Ref: [5] man page
+            // Open loop: requests are due at fixed times; a late reply makes the next ones late, and the
+            // latency is counted from when they were due
+            struct timespec ts = { due / NSEC_PER_SEC, due % NSEC_PER_SEC };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            start = due;
+            due += interval;
+        }
+        else
+            start = now_ns();
+
+        seek = seek_percent > 0 && (int)(rand_r(&seed) % 100) < seek_percent;
+        len = 0;
+        if (seek)
+            len = snprintf(line, max_size + 64, "AESDCHAR_IOCSEEKTO:%u,%u\n", rand_r(&seed) % SEEK_MAX_CMD,
+                           rand_r(&seed) % 8);
+
+        // A seek is followed by the smallest line, whose reply marks the end of the seek reply
+        size = seek ? MIN_LINE_SIZE : min_size + (max_size > min_size ? rand_r(&seed) % (max_size - min_size + 1) : 0);
+        len += make_line(line + len, size, result->conn, seq);
+
+        if (!send_all(fd, line, len))
+        {
+            result->error = "send failed";
+            break;
+        }
+        result->bytes_sent += len;
+
+        // The seek reply can hold own lines from anywhere in the buffer before the marker's reply starts over
+        result->error = await_line(fd, result, &reader, seq, !seek);
+        if (result->error != NULL)
+            break;
+        end = now_ns();
+
+        if (!samples_add(seek ? &result->seek_latency : &result->line_latency, end - start))
+        {
+            result->error = "out of memory";
+            break;
+        }
+        if (seek)
+            result->seeks++;
+        else
+            result->lines++;
+        seq++;
+    }
+
+    close(fd);
+    free(reader.buffer);
+    free(line);
+    return NULL;
+}
+
+/*************************************************************************
+ *                       Main Function                                   *
+ *************************************************************************/
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Value at quantile q of the sorted samples, in microseconds
+double percentile_us(const struct samples *s, double q)
+{
+    size_t index = (size_t)(q * s->len);
+
+    if (s->len == 0)
+        return 0;
+    if (index >= s->len)
+        index = s->len - 1;
+    return s->ns[index] / 1000.0;
+}
+
+// Merges the per connection samples selected by offset into all, sorted
+bool merge_samples(struct conn_result *results, int connections, size_t offset, struct samples *all)
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < connections; i++)
+    {
+        struct samples *s = (struct samples *)((char *)&results[i] + offset);
+        for (j = 0; j < s->len; j++)
+        {
+            if (!samples_add(all, s->ns[j]))
+                return false;
+        }
+        free(s->ns);
+    }
+
+    // Ref: [6] man page
+    qsort(all->ns, all->len, sizeof(*all->ns), compare_u64);
+    return true;
+}
+
+void print_latency(const char *name, const struct samples *s, double elapsed)
+{
+    if (s->len == 0)
+        return;
+    printf("%-6s %10zu %12.0f %10.1f %10.1f %10.1f %10.1f\n", name, s->len, s->len / elapsed,
+           percentile_us(s, 0.50), percentile_us(s, 0.99), percentile_us(s, 0.999), s->ns[s->len - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int connections = DEFAULT_CONNECTIONS;
+    int seconds = DEFAULT_SECONDS;
+    unsigned long long sent = 0, received = 0, bad = 0;
+    struct samples line_all = { NULL, 0, 0 }, seek_all = { NULL, 0, 0 };
+    struct timespec window;
+    struct conn_result *results;
+    uint64_t start, end;
+    double elapsed;
+    int opt, i, failed = 0;
+
+    while ((opt = getopt(argc, argv, "H:p:c:t:s:r:k:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H': host = optarg; break;
+            case 'p': port = optarg; break;
+            case 'c': connections = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%u-%u", &min_size, &max_size) != 2)
+                    max_size = min_size = atoi(optarg);
+                break;
+            case 'r': rate = atof(optarg); break;
+            case 'k': seek_percent = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-t seconds] [-s size|min-max] "
+                        "[-r rate] [-k percent]\n", argv[0]);
+                return FAILURE;
+        }
+    }
+    if (connections < 1 || seconds < 1 || rate < 0 || seek_percent < 0 || seek_percent > 100)
+    {
+        fprintf(stderr, "connections and seconds must be positive, rate not negative, percent 0 to 100\n");
+        return FAILURE;
+    }
+    if (min_size < MIN_LINE_SIZE || max_size > MAX_LINE_SIZE || min_size > max_size)
+    {
+        fprintf(stderr, "line sizes must be %d to %d bytes\n", MIN_LINE_SIZE, MAX_LINE_SIZE);
+        return FAILURE;
+    }
+
+    results = calloc(connections, sizeof(*results));
+    if (results == NULL)
+        return FAILURE;
+    run_id = (unsigned int)now_ns() ^ (unsigned int)getpid();
+
+    printf("# host=%s port=%s connections=%d seconds=%d size=%u-%u rate=%g seek=%d%% run=%08x\n", host, port,
+           connections, seconds, min_size, max_size, rate, seek_percent, run_id);
+
+    atomic_store(&stop_flag, false);
+    start = now_ns();
+
+    // Ref: [1] man page
+    for (i = 0; i < connections; i++)
+    {
+        results[i].conn = i;
+        pthread_create(&results[i].thread_id, NULL, connection_thread, &results[i]);
+    }
+
+    window.tv_sec = seconds;
+    window.tv_nsec = 0;
+    nanosleep(&window, NULL);
+    atomic_store(&stop_flag, true);
+
+    for (i = 0; i < connections; i++)
+    {
+        pthread_join(results[i].thread_id, NULL);
+        sent += results[i].bytes_sent;
+        received += results[i].bytes_received;
+        bad += results[i].bad_lines;
+        if (results[i].error != NULL)
+        {
+            fprintf(stderr, "connection %d: %s\n", i, results[i].error);
+            failed++;
+        }
+    }
+    end = now_ns();
+    elapsed = (end - start) / (double)NSEC_PER_SEC;
+
+    if (!merge_samples(results, connections, offsetof(struct conn_result, line_latency), &line_all) ||
+        !merge_samples(results, connections, offsetof(struct conn_result, seek_latency), &seek_all))
+    {
+        fprintf(stderr, "out of memory\n");
+        return FAILURE;
+    }
+
+    printf("%-6s %10s %12s %10s %10s %10s %10s\n", "op", "count", "per_sec", "p50_us", "p99_us", "p999_us", "max_us");
+    print_latency("line", &line_all, elapsed);
+    print_latency("seek", &seek_all, elapsed);
+    printf("# sent_MBps=%.2f received_MBps=%.2f bad_lines=%llu failed_connections=%d\n",
+           sent / elapsed / (1024 * 1024), received / elapsed / (1024 * 1024), bad, failed);
+
+    free(line_all.ns);
+    free(seek_all.ns);
+    free(results);
+    return (bad || failed) ? FAILURE : SUCCESS;
+}
@@ -47,17 +47,60 @@
  *            : [22] strftime           - https://man7.org/linux/man-pages/man3/strftime.3.html
  *            : [23] clock_gettime      - https://www.man7.org/linux/man-pages/man2/clock_gettime.2.html
  *            : [24] localtime_r        - httpshttps://linux.die.net/man/3/localtime_r
+ *            : [25] epoll              - https://www.man7.org/linux/man-pages/man7/epoll.7.html
+ *            : [26] accept4            - https://www.man7.org/linux/man-pages/man2/accept.2.html
+ *            : [27] pthread_cond_wait  - https://www.man7.org/linux/man-pages/man3/pthread_cond_wait.3p.html
+ *            : [28] sysconf            - https://www.man7.org/linux/man-pages/man3/sysconf.3.html
+ *            : [29] getopt             - https://www.man7.org/linux/man-pages/man3/getopt.3.html
+ *            : [30] poll               - https://www.man7.org/linux/man-pages/man2/poll.2.html
+ *            : [31] pthread_sigmask    - https://www.man7.org/linux/man-pages/man3/pthread_sigmask.3.html
+ *            : [32] sendfile           - https://www.man7.org/linux/man-pages/man2/sendfile.2.html
+ *            : [33] splice             - https://www.man7.org/linux/man-pages/man2/splice.2.html
+ *            : [34] tcp (TCP_CORK)     - https://www.man7.org/linux/man-pages/man7/tcp.7.html
+ *            : [35] strtoull           - https://www.man7.org/linux/man-pages/man3/strtoull.3.html
+ *            : [36] timerfd_create     - https://www.man7.org/linux/man-pages/man2/timerfd_create.2.html
+ *            : [37] shutdown           - https://www.man7.org/linux/man-pages/man2/shutdown.2.html
+ *            : [38] pread              - https://www.man7.org/linux/man-pages/man2/pread.2.html
+ *            : [39] Prometheus text format - https://prometheus.io/docs/instrumenting/exposition_formats/
+ *            : [40] open_memstream     - https://www.man7.org/linux/man-pages/man3/open_memstream.3.html
+ *            : [41] vsnprintf          - https://www.man7.org/linux/man-pages/man3/vsnprintf.3.html
  *
  * Update     : Assignment 6 Part 1 
  * Description:  15) Multiple connections are accepted simultaneously using pthread and content is written to DATA_FILE, logged every 10 secs utilizing locks
  * Update      : Assignment 7, 8, 9             
  * 
+ * Update     : Event loop
+ * Description:  16) Connections are accepted without blocking by an edge-triggered epoll reactor on sockfd and serviced
+ *                   by a fixed pool of worker threads (-w <count>, defaults to the number of online cores)
+ *               17) Replies are streamed with sendfile() (regular file) or splice() through a pipe (aesdchar), or
+ *                   with a corked, adaptive read()/send() loop; selected with -r zerocopy|copy
+ *               18) lock only covers appending a packet and recording the resulting length; the reply streams that
+ *                   snapshot without holding it
+ *               19) In file mode, an append-only in-memory copy of DATA_FILE (-m <bytes> cap) serves replies; the
+ *                   file is only read at startup, or for replies once the history outgrows the cap
+ *               20) SINCE:<offset> returns "SINCE:<end>\n" followed by DATA_FILE from offset to end, so tailing
+ *                   clients only receive new data; sending the header line back asks for the next increment
+ *               21) Received bytes are reassembled into lines per connection; every line is answered in order and
+ *                   the connection stays open for more lines until the client closes it
+ *               22) Connections idle for -i <seconds> are closed, checked by a timerfd in the event loop; at most
+ *                   -c <count> connections are open, further clients wait in the listen backlog
+ *               23) Timestamps come from an absolute CLOCK_REALTIME timerfd in the event loop instead of a sleeping
+ *                   thread, and each is appended with a single write() on a file descriptor kept open
+ *               24) DATA_FILE stays open: one shared append fd in file mode, one fd per worker for aesdchar; replies
+ *                   read at explicit offsets (pread, sendfile/splice offsets) instead of reopening the file
+ *               25) Per-thread counters (connections, bytes, lines, seeks, lock waits, reply latency histogram) are
+ *                   served in Prometheus text format on 127.0.0.1, port -M <port> (0 disables)
+ *               26) Messages from the request path go through LOG_MSG() into per-thread rings that a background
+ *                   thread drains to syslog and stdout; levels above LOG_MIN_LEVEL are compiled out
+ * 
  */
 
 /*************************************************************************
  *                            Header Files                               *
  *************************************************************************/
- 
+
+#define _GNU_SOURCE                              // accept4
+
 #include <stdio.h>                               // Standard input output library
 #include <stdlib.h>                              // General purpose utility functions
 #include <syslog.h>                              // System logging
@@ -71,7 +114,7 @@
 #include <netinet/in.h>                          // IP struct; struct sockaddr_in
 #include <arpa/inet.h>                           // Internet addresses to text representations; inet_ntoa
 #include <netdb.h>                               // Network database ops; getaddrinfo
-                             
+
 #include "queue.h"                               // For singly linked list APIs
 #include <pthread.h>                             // POSIX threads library
 #include <stdbool.h>                             // POSIX threads library
@@ -79,355 +122,1704 @@
 #include "../aesd-char-driver/aesd_ioctl.h"      // Added for A9
 #include <fcntl.h>                               // For file ops
 
+#include <errno.h>                               // errno; EAGAIN, EINTR
+#include <poll.h>                                // poll; wait for socket to become writable
+#include <sys/epoll.h>                           // epoll event loop
+#include <sys/sendfile.h>                        // sendfile; zero-copy reply from a regular file
+#include <sys/stat.h>                            // fstat; pick the reply path for DATA_FILE
+#include <netinet/tcp.h>                         // TCP_CORK
+#include <sys/timerfd.h>                         // timerfd; idle connection checks in the event loop
+#include <stdatomic.h>                           // Connection state shared by the event loop and workers
+#include <stddef.h>                              // offsetof; summing a metric over the thread slots
+#include <stdarg.h>                              // va_list; LOG_MSG() formatting
+
 /*************************************************************************
  *                            Macros                                     *
  *************************************************************************/
- 
+
 #define RET_FAILURE                       (-1)                          // Return value check
 #define FAILURE                           (1)
 #define SUCCESS                           (0)
 
 #define PORT                              ("9000")                      // For Opening a stream socket bound to port 9000
 
-//#define DATA_FILE                         ("/var/tmp/aesdsocketdata")   // Receives data over the connection and appends to this file 
+//#define DATA_FILE                         ("/var/tmp/aesdsocketdata")   // Receives data over the connection and appends to this file
+
+// Backend: /dev/aesdchar by default; build with -DUSE_AESD_CHAR_DEVICE=0 (make USE_AESD_CHAR_DEVICE=0) for the
+// regular file, which also enables the history cache
+#ifndef USE_AESD_CHAR_DEVICE
+    #define USE_AESD_CHAR_DEVICE          (1)
+#endif
+#if !USE_AESD_CHAR_DEVICE
+    #undef USE_AESD_CHAR_DEVICE
+#endif
+
+#ifdef USE_AESD_CHAR_DEVICE
+    #define DATA_FILE                     ("/dev/aesdchar")
+#else
+    #define DATA_FILE                     ("/var/tmp/aesdsocketdata")
+#endif
+
+#define BUFFER_SIZE                       (1024)
+
+// Ref: [22] man page
+#define RFC2822_compliant_strftime_format ("timestamp:%a, %d %b %Y %T %z\n")
+#define TIMESTAMP_INTERVAL                (10)                          // Seconds between timestamps in file mode
+
+#define IOCTL_STRING                      ("AESDCHAR_IOCSEEKTO:")
+#define IOCTL_STRING_LENGTH               (19)
+#define SINCE_STRING                      ("SINCE:")                    // SINCE:<offset> - only bytes after offset
+#define SINCE_STRING_LENGTH               (6)
+
+#define MAX_EVENTS                        (64)                          // Events handled per epoll_wait() call
+#define REPLY_BUFFER_MAX                  (64 * 1024)                   // Largest buffer the copy reply path grows to
+#define REPLY_CHUNK_SIZE                  (1024 * 1024)                 // Bytes moved per sendfile()/splice() call
+
+#define IDLE_TIMEOUT_DEFAULT              (60)                          // Seconds, -i <seconds> overrides, 0 disables
+#define IDLE_CHECK_INTERVAL               (1)                           // Seconds between idle connection checks
+#define MAX_CONNECTIONS_DEFAULT           (1024)                        // -c <count> overrides
+
+#define METRICS_PORT_DEFAULT              (9001)                        // -M <port> overrides, 0 disables
+#define METRICS_REQUEST_TIMEOUT           (1)                           // Seconds to wait for a scrape request
+#define LATENCY_BUCKETS                   (22)                          // Powers of two from 1 us to ~1 s, then +Inf
+#define CACHE_LINE_SIZE                   (64)
+
+// Messages less severe than LOG_MIN_LEVEL cost nothing: LOG_MSG() drops them at compile time, arguments
+// included. Build with CFLAGS="-Wall -Werror -g -DLOG_MIN_LEVEL=LOG_DEBUG" to see every request.
+#ifndef LOG_MIN_LEVEL
+    #define LOG_MIN_LEVEL                 LOG_INFO
+#endif
+#define LOG_RING_SIZE                     (256)                         // Records per thread, a power of two
+#define LOG_MSG_SIZE                      (128)                         // Longer messages are truncated
+#define LOG_DRAIN_INTERVAL_NS             (50 * 1000 * 1000)            // Drain thread wakes every 50 ms
+
+// Reply path, -r zerocopy|copy at runtime; build with -DREPLY_MODE_DEFAULT=REPLY_MODE_COPY to change the default
+#define REPLY_MODE_ZEROCOPY               (0)                           // sendfile() for a regular file, splice() for aesdchar
+#define REPLY_MODE_COPY                   (1)                           // read() into a user space buffer and send()
+#ifndef REPLY_MODE_DEFAULT
+    #define REPLY_MODE_DEFAULT            REPLY_MODE_ZEROCOPY
+#endif
+#define LISTEN_BACKLOG                    (SOMAXCONN)                   // Pending connections queued by the kernel before accept()
+
+#define HISTORY_CHUNK_SIZE                (64 * 1024)                   // Allocation unit of the in-memory history
+#ifdef USE_AESD_CHAR_DEVICE
+    #define HISTORY_CAP_DEFAULT           (0)                           // The driver keeps its own history
+#else
+    #define HISTORY_CAP_DEFAULT           (64 * 1024 * 1024)            // -m <bytes> overrides, 0 disables
+#endif
+
+/*************************************************************************
+ *                  Global Variables                                     *
+ *************************************************************************/
+
+int sockfd;                                       // Socket function return val
+int epollfd;                                      // epoll instance of the event loop
+
+pthread_mutex_t lock;                             // Serializes appends (packets and timestamp) to DATA_FILE
+volatile bool signal_exit = false;                // Flag to indicate signal detected
+
+pthread_t *worker_threads;                        // Worker pool servicing client connections
+int num_workers;                                  // Number of threads in worker pool
+int reply_mode = REPLY_MODE_DEFAULT;              // How DATA_FILE is copied to the client
+
+__thread int reply_pipe[2] = {-1, -1};            // Per worker pipe for splice(), created on first use
+__thread int device_fd = -1;                      // Per worker /dev/aesdchar fd, opened on first use
+__thread char *reply_buffer;                      // Per worker buffer of the copy reply path, grown on demand
+__thread size_t reply_buffer_size;
+int data_fd = -1;                                 // File mode: DATA_FILE, open for appending and pread()
+off_t data_len = 0;                               // File mode: length of DATA_FILE, protected by lock
+size_t history_cap = HISTORY_CAP_DEFAULT;         // Most bytes of DATA_FILE kept in memory
+int idle_timeout = IDLE_TIMEOUT_DEFAULT;          // Seconds a connection may stay silent
+int max_connections = MAX_CONNECTIONS_DEFAULT;    // Open connections before accepting pauses
+int idle_timerfd = -1;                            // Periodic idle check; &idle_timerfd tags it in epoll
+int timestamp_timerfd = -1;                       // Timestamp deadlines; &timestamp_timerfd tags it in epoll
+int metrics_port = METRICS_PORT_DEFAULT;          // Loopback port of the metrics endpoint
+int metrics_sockfd = -1;                          // Metrics endpoint listening socket
+pthread_t metrics_thread;                         // Serves metrics_sockfd
+
+/*************************************************************************
+ *                        Structures                                     *
+ *************************************************************************/
+// Ref: [20] man page
+// timespec - time in seconds and nanoseconds
+// Member obj: time_t tv_sec, tv_nsec
+struct timespec time_now;                        // Time of the timestamp being written
+
+// Ref: [21] man page
+// tm - broken-down time
+/* struct tm {
+	int         tm_sec;    // Seconds          [0, 60]
+    int         tm_min;    // Minutes          [0, 59]
+    int         tm_hour;   // Hour             [0, 23]
+    int         tm_mday;   // Day of the month [1, 31]
+    int         tm_mon;    // Month            [0, 11]  (January = 0)
+    int         tm_year;   // Year minus 1900
+    int         tm_wday;   // Day of the week  [0, 6]   (Sunday = 0)
+    int         tm_yday;   // Day of the year  [0, 365] (Jan/01 = 0)
+    int         tm_isdst;  // Daylight savings flag
+
+    long        tm_gmtoff; // Seconds East of UTC
+    const char *tm_zone;   // Timezone abbreviation
+}; */
+struct tm time_info;                                // time info in tm
+
+// Ref: [17] queue.h
+// One node per open client connection. A node is owned by the event loop while its fd is armed in epoll
+// and by exactly one worker while it sits on (or has been taken off) the work queue; EPOLLONESHOT
+// guarantees it is never handed to two workers at once.
+typedef struct client_conn_s client_conn_t;
+struct client_conn_s
+{
+    int newfd;                                      // File descriptor of client connection
+    char ip_address[INET_ADDRSTRLEN];               // inet_ntop return val, for syslog
+    char *packet;                                   // Received bytes not yet processed: at most one partial line
+    size_t packet_len;                              // Bytes stored in packet
+    size_t packet_size;                             // Bytes allocated for packet
+    size_t scan_len;                                // Leading bytes of packet already searched for '\n'
+    atomic_long last_active;                        // CLOCK_MONOTONIC seconds when last serviced
+    atomic_bool busy;                               // Queued for or being serviced by a worker
+    atomic_bool expired;                            // Shut down for being idle
+    LIST_ENTRY(client_conn_s) entries;              // Open connections list
+    STAILQ_ENTRY(client_conn_s) work_entries;       // Work queue of the worker pool
+};
+
+/* LIST_HEAD(name, type)
+struct name {								   \
+	struct type *lh_first;	// first element   \
+}*/
+LIST_HEAD(connlisthead, client_conn_s) conn_head;  // All open connections, closed on exit
+pthread_mutex_t conn_lock;                         // Protects conn_head, num_connections and accept_paused
+int num_connections = 0;                           // Entries in conn_head
+bool accept_paused = false;                        // sockfd disarmed because max_connections are open
+
+/* STAILQ_HEAD(name, type)
+struct name {								        \
+	struct type *stqh_first;  // first element      \
+	struct type **stqh_last;  // addr of last next  \
+}*/
+STAILQ_HEAD(workqhead, client_conn_s) work_head;   // Connections with data ready, waiting for a worker
+pthread_mutex_t work_lock;                         // Protects work_head and worker_exit
+pthread_cond_t work_cond;                          // Signalled when work_head gets an entry
+bool worker_exit = false;                          // Flag to stop the worker pool
+
+// In-memory copy of DATA_FILE from offset 0, in fixed size chunks that never move once allocated. Appends
+// happen under lock, together with the write to DATA_FILE. A reply takes len as its snapshot under lock
+// and then reads the chunks without it: bytes below a snapshot are never modified, and chunks are only
+// freed at exit. Once DATA_FILE outgrows the cap, full is set and replies go back to the file.
+typedef struct history_cache_s
+{
+    char **chunks;                                 // Chunk directory, sized for history_cap up front
+    size_t max_chunks;                             // Entries in chunks
+    size_t len;                                    // Bytes stored; equals the length of DATA_FILE unless full
+    bool enabled;                                  // Cap is non-zero and the directory was allocated
+    bool full;                                     // Stopped following DATA_FILE
+} history_cache_t;
+
+history_cache_t history;                           // Protected by lock
+
+// Counters of one thread: the event loop has slot 0, worker n slot n + 1. Only the owning thread writes
+// its slot, so an update is a relaxed load and store with no atomic read-modify-write, and slots are cache
+// line aligned so threads never write the same line. The metrics endpoint sums all slots when scraped.
+typedef struct thread_metrics_s
+{
+    atomic_ullong connections_accepted;
+    atomic_ullong connections_closed;
+    atomic_ullong bytes_in;                        // Received from clients
+    atomic_ullong bytes_out;                       // Sent to clients
+    atomic_ullong lines;                           // Lines processed, commands included
+    atomic_ullong ioctl_seeks;                     // AESDCHAR_IOCSEEKTO commands
+    atomic_ullong since_requests;                  // SINCE:<offset> commands
+    atomic_ullong lock_acquired;                   // Acquisitions of lock
+    atomic_ullong lock_contended;                  // ... that had to wait
+    atomic_ullong lock_wait_ns;                    // Total time spent waiting
+    atomic_ullong latency_bucket[LATENCY_BUCKETS]; // Line received to reply sent, bucket i < 2^i us
+    atomic_ullong latency_ns;                      // Sum of all observed latencies
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_metrics_t;
+
+thread_metrics_t *metrics;                         // num_workers + 1 slots
+__thread thread_metrics_t *metrics_self;           // Slot of the calling thread, NULL if it has none
+
+// Per-thread log ring, single producer (the owning thread) and single consumer (the drain thread). A
+// message is formatted into the next free record and published by advancing head; the drain thread
+// writes records out and advances tail. When the ring is full new messages are dropped and counted
+// rather than making the request path wait.
+typedef struct log_record_s
+{
+    int level;                                     // syslog priority
+    char msg[LOG_MSG_SIZE];
+} log_record_t;
+
+typedef struct log_ring_s
+{
+    log_record_t records[LOG_RING_SIZE];
+    atomic_uint head;                              // Next record to fill; written by the owning thread
+    atomic_uint tail;                              // Next record to drain; written by the drain thread
+    atomic_ullong dropped;                         // Messages lost to a full ring
+} __attribute__((aligned(CACHE_LINE_SIZE))) log_ring_t;
+
+log_ring_t *log_rings;                             // num_workers + 1 rings, indexed like metrics
+__thread log_ring_t *log_self;                     // Ring of the calling thread, NULL logs synchronously
+pthread_t log_thread;                              // Drains log_rings
+atomic_bool log_exit;                              // Stops the drain thread
+
+// Logs at a syslog level; compiled out entirely below LOG_MIN_LEVEL
+#define LOG_MSG(level, ...)                                                                                \
+    do {                                                                                                   \
+        if ((level) <= LOG_MIN_LEVEL)                                                                      \
+            log_write((level), __VA_ARGS__);                                                               \
+    } while (0)
+
+// Adds n to a counter of the calling thread's slot
+#define METRIC_ADD(field, n)                                                                               \
+    do {                                                                                                   \
+        if (metrics_self != NULL)                                                                          \
+            atomic_store_explicit(&metrics_self->field,                                                    \
+                atomic_load_explicit(&metrics_self->field, memory_order_relaxed) + (n), memory_order_relaxed); \
+    } while (0)
+
+/*************************************************************************
+ *                    Logger Functions                                   *
+ *************************************************************************/
+
+// Queues a message on the calling thread's ring. Threads without a ring (startup, the metrics thread)
+// log synchronously.
+void log_write(int level, const char *format, ...)
+{
+    log_ring_t *ring = log_self;
+    log_record_t *record;
+    unsigned int head;
+    va_list args;
+
+    va_start(args, format);
+    if (ring == NULL)
+    {
+        vsyslog(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SIZE)
+    {
+        // A read-modify-write, as log_drain resets the count with atomic_exchange from its own thread
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    // Ref: [41] man page
+    record = &ring->records[head % LOG_RING_SIZE];
+    record->level = level;
+    vsnprintf(record->msg, sizeof(record->msg), format, args);
+    va_end(args);
+
+    // Release: the drain thread sees the whole record once it sees the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Writes out everything queued on every ring; drain thread, or cleanup() once the other threads are gone
+void log_drain()
+{
+    unsigned long long dropped;
+    unsigned int head, tail;
+    log_record_t *record;
+    size_t len;
+    int i;
+
+    for (i = 0; i <= num_workers; i++)
+    {
+        tail = atomic_load_explicit(&log_rings[i].tail, memory_order_relaxed);
+        head = atomic_load_explicit(&log_rings[i].head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            record = &log_rings[i].records[tail % LOG_RING_SIZE];
+            syslog(record->level, "%s", record->msg);
+
+            len = strlen(record->msg);
+            printf("%s%s", record->msg, (len > 0 && record->msg[len - 1] == '\n') ? "" : "\n");
+        }
+        atomic_store_explicit(&log_rings[i].tail, tail, memory_order_release);
+
+        if ((dropped = atomic_exchange(&log_rings[i].dropped, 0)) > 0)
+            syslog(LOG_WARNING, "Dropped %llu log messages; log ring %d was full\n", dropped, i);
+    }
+    fflush(stdout);
+}
+
+void *log_handler(void *arg)
+{
+    struct timespec interval = { 0, LOG_DRAIN_INTERVAL_NS };
+
+    while (!atomic_load(&log_exit))
+    {
+        log_drain();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+// Allocates the rings (slot 0 for the calling thread, the event loop) and starts the drain thread
+int log_init()
+{
+    log_rings = aligned_alloc(CACHE_LINE_SIZE, (num_workers + 1) * sizeof(log_ring_t));
+    if (log_rings == NULL)
+        return RET_FAILURE;
+    memset(log_rings, 0, (num_workers + 1) * sizeof(log_ring_t));
+    atomic_store(&log_exit, false);
+
+    if (pthread_create(&log_thread, NULL, log_handler, NULL) != SUCCESS)
+    {
+        free(log_rings);
+        log_rings = NULL;
+        return RET_FAILURE;
+    }
+    log_self = &log_rings[0];
+    return SUCCESS;
+}
+
+// Stops the drain thread and writes out what is left; the workers must be joined already
+void log_stop()
+{
+    if (log_rings == NULL)
+        return;
+
+    atomic_store(&log_exit, true);
+    pthread_join(log_thread, NULL);
+    log_self = NULL;
+    log_drain();
+    free(log_rings);
+    log_rings = NULL;
+}
+
+/*************************************************************************
+ *                    Metrics Functions                                  *
+ *************************************************************************/
+
+// Nanoseconds elapsed since start on CLOCK_MONOTONIC
+unsigned long long elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    // Ref: [23] man page
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+// Takes lock, counting how often and how long callers had to wait for it. The uncontended case costs
+// one trylock and no clock reads.
+void lock_data()
+{
+    struct timespec start;
+
+    if (pthread_mutex_trylock(&lock) != SUCCESS)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&lock);
+        METRIC_ADD(lock_contended, 1);
+        METRIC_ADD(lock_wait_ns, elapsed_ns(&start));
+    }
+    METRIC_ADD(lock_acquired, 1);
+}
+
+// Records the latency of one reply, from the line being complete (start) to the reply being sent
+void observe_latency(const struct timespec *start)
+{
+    unsigned long long ns = elapsed_ns(start);
+    unsigned long long us = ns / 1000;
+    int bucket = (us == 0) ? 0 : 64 - __builtin_clzll(us);        // Smallest i with us < 2^i
+
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+    METRIC_ADD(latency_bucket[bucket], 1);
+    METRIC_ADD(latency_ns, ns);
+}
+
+/*************************************************************************
+ *                    Connection Functions                               *
+ *************************************************************************/
+
+// Current CLOCK_MONOTONIC time in seconds, for idle timeouts
+long monotonic_seconds()
+{
+    struct timespec now;
+
+    // Ref: [23] man page
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+// Arms (or disarms) sockfd in epoll; caller holds conn_lock. While disarmed, new clients wait in the
+// kernel's listen backlog, and once that is full their connection attempts are not answered.
+void set_accepting(bool accepting)
+{
+    struct epoll_event event;
+
+    event.events = accepting ? (EPOLLIN | EPOLLET) : 0;
+    event.data.ptr = NULL;
+
+    // Ref: [25] man page
+    // EPOLL_CTL_MOD re-checks readiness, so clients queued while paused are reported on resume
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, sockfd, &event) == RET_FAILURE)
+    {
+        LOG_MSG(LOG_ERR,"Error updating socket in epoll; epoll_ctl() failure\n");
+        return;
+    }
+    accept_paused = !accepting;
+    LOG_MSG(LOG_INFO,"%s accepting connections, %d open\n", accepting ? "Resumed" : "Paused", num_connections);
+}
+
+// Unlinks a connection from the open connections list, closes its socket (which also removes it from
+// the epoll interest list) and frees it
+void close_connection(client_conn_t *conn)
+{
+    METRIC_ADD(connections_closed, 1);
+
+    pthread_mutex_lock(&conn_lock);
+    LIST_REMOVE(conn, entries);
+    num_connections--;
+    if (accept_paused && num_connections < max_connections)
+        set_accepting(true);
+    pthread_mutex_unlock(&conn_lock);
+
+    close(conn->newfd);
+
+    // Logs message to the syslog “Closed connection from XXX” where XXX is the IP address of the connected client.
+    LOG_MSG(LOG_INFO, "Closed connection from %s\n", conn->ip_address);
+
+    free(conn->packet);
+    free(conn);
+}
+
+// Re-enables a connection in epoll once a worker has drained it; must be the last access to conn by the worker
+int rearm_connection(client_conn_t *conn)
+{
+    struct epoll_event event;
+
+    // From here on the idle check may shut the connection down; the event that causes brings it back
+    atomic_store(&conn->last_active, monotonic_seconds());
+    atomic_store(&conn->busy, false);
+
+    event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+    event.data.ptr = conn;
+
+    // Ref: [25] man page
+    // int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+    // EPOLL_CTL_MOD re-checks readiness, so data that arrived after recv() returned EAGAIN is not lost
+    return epoll_ctl(epollfd, EPOLL_CTL_MOD, conn->newfd, &event);
+}
+
+// Waits until a non-blocking socket can take more data. A client that takes nothing for the idle timeout
+// (IDLE_TIMEOUT_DEFAULT if -i 0) would otherwise hold a worker forever, so the socket is shut down and
+// RET_FAILURE returned; the worker then sees EOF and closes the connection as usual.
+int wait_writable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    int timeout_ms = ((idle_timeout > 0) ? idle_timeout : IDLE_TIMEOUT_DEFAULT) * 1000;
+    int rc;
+
+    // Ref: [30] man page
+    // int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+    while ((rc = poll(&pfd, 1, timeout_ms)) == RET_FAILURE && errno == EINTR)
+        ;
+    if (rc > 0)
+        return SUCCESS;
+
+    LOG_MSG(LOG_INFO,"Client stopped reading its reply; dropping the connection\n");
+    // Ref: [37] man page
+    shutdown(fd, SHUT_RDWR);
+    return RET_FAILURE;
+}
+
+// Sends len bytes on a non-blocking socket, waiting with wait_writable() whenever the socket buffer is full
+int send_all(int fd, const char *buf, size_t len)
+{
+    ssize_t sent_bytes;
+
+    while (len > 0)
+    {
+        // Ref: [16] man page
+        // ssize_t send(int sockfd, const void buf[.len], size_t len, int flags);
+        // MSG_NOSIGNAL - a client that went away returns EPIPE instead of raising SIGPIPE
+        sent_bytes = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent_bytes == RET_FAILURE)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(fd) == SUCCESS)
+                continue;
+            return RET_FAILURE;
+        }
+        METRIC_ADD(bytes_out, sent_bytes);
+        buf += sent_bytes;
+        len -= sent_bytes;
+    }
+    return SUCCESS;
+}
+
+// Appends a received chunk to the connection packet buffer, growing it geometrically
+int append_packet(client_conn_t *conn, const char *data, size_t len)
+{
+    char *new_packet;
+    size_t new_size;
+
+    // Keep one spare byte so the packet can be NUL terminated for sscanf
+    if (conn->packet_len + len + 1 > conn->packet_size)
+    {
+        new_size = (conn->packet_size == 0) ? BUFFER_SIZE : conn->packet_size;
+        while (conn->packet_len + len + 1 > new_size)
+            new_size *= 2;
+
+        new_packet = realloc(conn->packet, new_size);
+        if (new_packet == NULL)
+            return RET_FAILURE;
+        conn->packet = new_packet;
+        conn->packet_size = new_size;
+    }
+    memcpy(conn->packet + conn->packet_len, data, len);
+    conn->packet_len += len;
+    conn->packet[conn->packet_len] = '\0';
+    return SUCCESS;
+}
+
+/*************************************************************************
+ *                        Reply Functions                                *
+ *************************************************************************/
+
+// Copy path: pread() into a user space buffer and send() it. The buffer starts at BUFFER_SIZE and doubles
+// up to REPLY_BUFFER_MAX while reads keep filling it; the socket is corked so short reads still leave in
+// full segments. The buffer belongs to the worker and is kept for its next reply, so it is only allocated
+// as large as the replies it has actually served, and not once per reply.
+int send_file_copy(int sockfd_out, int fd, off_t offset, size_t count)
+{
+    size_t buffer_size = (reply_buffer_size > BUFFER_SIZE) ? reply_buffer_size : BUFFER_SIZE;
+    char *grown;
+    ssize_t read_bytes = 0;
+    int on = 1, off = 0;
+    int rc = SUCCESS;
+
+    // Ref: [34] man page
+    setsockopt(sockfd_out, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+    // Ref: [38] man page
+    // Reads data from file at offset, leaving the file position of the shared fd alone
+    // ssize_t pread(int fd, void buf[.count], size_t count, off_t offset);
+    while (count > 0)
+    {
+        if (reply_buffer_size < buffer_size)
+        {
+            if ((grown = realloc(reply_buffer, buffer_size)) == NULL)
+            {
+                rc = RET_FAILURE;
+                break;
+            }
+            reply_buffer = grown;
+            reply_buffer_size = buffer_size;
+        }
+
+        read_bytes = pread(fd, reply_buffer, (count < buffer_size) ? count : buffer_size, offset);
+        if (read_bytes <= 0)
+            break;
+
+        // Returns data to client
+        if (send_all(sockfd_out, reply_buffer, read_bytes) == RET_FAILURE)
+        {
+            rc = RET_FAILURE;
+            break;
+        }
+        count -= read_bytes;
+        offset += read_bytes;
+
+        if ((size_t)read_bytes == buffer_size && buffer_size < REPLY_BUFFER_MAX)
+            buffer_size *= 2;
+    }
+    if (read_bytes == RET_FAILURE)
+        rc = RET_FAILURE;
+
+    // Uncorking flushes the last partial segment
+    setsockopt(sockfd_out, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    return rc;
+}
+
+// Zero-copy path for a regular file; sendfile() reads from offset without moving the file position of fd
+int send_file_sendfile(int sockfd_out, int fd, off_t offset, size_t count)
+{
+    ssize_t sent_bytes;
+
+    while (count > 0)
+    {
+        // Ref: [32] man page
+        // ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+        sent_bytes = sendfile(sockfd_out, fd, &offset, (count < REPLY_CHUNK_SIZE) ? count : REPLY_CHUNK_SIZE);
+        if (sent_bytes == 0)
+            break;                                                           // End of file
+
+        if (sent_bytes == RET_FAILURE)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(sockfd_out) == SUCCESS)
+                continue;
+            return RET_FAILURE;
+        }
+        METRIC_ADD(bytes_out, sent_bytes);
+        count -= sent_bytes;
+    }
+    return SUCCESS;
+}
+
+// Zero-copy path for a character device: splice() DATA_FILE from offset into the worker's pipe, then the
+// pipe into the socket. Returns 1 without sending anything if the driver does not support splice.
+int send_file_splice(int sockfd_out, int fd, off_t offset, size_t count)
+{
+    ssize_t in_pipe, spliced;
+    bool first = true;
+
+    if (reply_pipe[0] == -1 && pipe2(reply_pipe, O_CLOEXEC) == RET_FAILURE)
+        return 1;
+
+    while (count > 0)
+    {
+        // Ref: [33] man page
+        // ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
+        in_pipe = splice(fd, &offset, reply_pipe[1], NULL, (count < REPLY_CHUNK_SIZE) ? count : REPLY_CHUNK_SIZE,
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe == 0)
+            break;                                                           // End of file
+
+        if (in_pipe == RET_FAILURE)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // No splice_read in the driver; nothing has been sent yet, so the caller can copy instead
+            if (first && errno == EINVAL)
+                return 1;
+            return RET_FAILURE;
+        }
+        first = false;
+        count -= in_pipe;
+
+        while (in_pipe > 0)
+        {
+            spliced = splice(reply_pipe[0], NULL, sockfd_out, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (spliced == RET_FAILURE)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(sockfd_out) == SUCCESS)
+                    continue;
+
+                // Bytes left in the pipe belong to this reply; drop the pipe so the next reply starts empty
+                close(reply_pipe[0]);
+                close(reply_pipe[1]);
+                reply_pipe[0] = reply_pipe[1] = -1;
+                return RET_FAILURE;
+            }
+            METRIC_ADD(bytes_out, spliced);
+            in_pipe -= spliced;
+        }
+    }
+    return SUCCESS;
+}
+
+// Sends at most count bytes of DATA_FILE from offset of fd, stopping early at end of file, using the path
+// selected by reply_mode. SIZE_MAX sends everything up to end of file. The file position of fd is not
+// used, so workers can share one fd.
+int send_file(int sockfd_out, int fd, off_t offset, size_t count)
+{
+    struct stat st;
+    int rc;
+
+    if (reply_mode == REPLY_MODE_ZEROCOPY && fstat(fd, &st) == SUCCESS)
+    {
+        if (S_ISREG(st.st_mode))
+            return send_file_sendfile(sockfd_out, fd, offset, count);
+
+        rc = send_file_splice(sockfd_out, fd, offset, count);
+        if (rc != 1)
+            return rc;
+    }
+    return send_file_copy(sockfd_out, fd, offset, count);
+}
+
+/*************************************************************************
+ *                    History Cache Functions                            *
+ *************************************************************************/
+
+// Appends len bytes just written to DATA_FILE to the history; caller holds lock. If the cap would be
+// exceeded the history stops following the file for good
+void history_append(const char *data, size_t len)
+{
+    size_t chunk_index, chunk_offset, copy_len;
+
+    if (!history.enabled || history.full)
+        return;
+
+    if (history.len + len > history.max_chunks * HISTORY_CHUNK_SIZE)
+    {
+        history.full = true;
+        LOG_MSG(LOG_INFO,"History cache full at %zu bytes; replies are read from %s\n", history.len, DATA_FILE);
+        return;
+    }
+
+    while (len > 0)
+    {
+        chunk_index = history.len / HISTORY_CHUNK_SIZE;
+        chunk_offset = history.len % HISTORY_CHUNK_SIZE;
+        if (history.chunks[chunk_index] == NULL)
+        {
+            history.chunks[chunk_index] = malloc(HISTORY_CHUNK_SIZE);
+            if (history.chunks[chunk_index] == NULL)
+            {
+                LOG_MSG(LOG_ERR,"Error growing history cache; malloc() failure\n");
+                history.full = true;
+                return;
+            }
+        }
+        copy_len = HISTORY_CHUNK_SIZE - chunk_offset;
+        if (copy_len > len)
+            copy_len = len;
+        memcpy(history.chunks[chunk_index] + chunk_offset, data, copy_len);
+        history.len += copy_len;
+        data += copy_len;
+        len -= copy_len;
+    }
+}
+
+// Sets up the history and loads whatever DATA_FILE already holds, e.g. after a restart without cleanup
+void history_init(size_t cap)
+{
+    char buffer[BUFFER_SIZE];
+    ssize_t read_bytes;
+    int fd;
+
+    memset(&history, 0, sizeof(history));
+
+    #ifdef USE_AESD_CHAR_DEVICE
+    // The driver drops old entries, so a copy of everything written would not match its contents
+    cap = 0;
+    #endif
+    if (cap == 0)
+        return;
+
+    history.max_chunks = (cap + HISTORY_CHUNK_SIZE - 1) / HISTORY_CHUNK_SIZE;
+    history.chunks = (char **) calloc(history.max_chunks, sizeof(char *));
+    if (history.chunks == NULL)
+    {
+        syslog(LOG_ERR,"Error allocating history cache; calloc() failure\n"); //syslog error
+        return;
+    }
+    history.enabled = true;
+
+    if ((fd = open(DATA_FILE, O_RDONLY)) == RET_FAILURE)
+        return;                                                              // Nothing stored yet
+
+    while (!history.full && (read_bytes = read(fd, buffer, sizeof(buffer))) > 0)
+        history_append(buffer, read_bytes);
+    close(fd);
+
+    syslog(LOG_INFO,"History cache loaded %zu bytes from %s\n", history.len, DATA_FILE);
+}
+
+// Sends bytes offset up to count of the history; count is a snapshot of history.len taken under lock
+int history_send(int sockfd_out, size_t offset, size_t count)
+{
+    size_t send_len;
+    int on = 1, off = 0;
+    int rc = SUCCESS;
+
+    // Ref: [34] man page
+    // Corked so the chunk boundaries do not produce short segments
+    setsockopt(sockfd_out, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    while (offset < count)
+    {
+        send_len = HISTORY_CHUNK_SIZE - offset % HISTORY_CHUNK_SIZE;
+        if (send_len > count - offset)
+            send_len = count - offset;
+
+        if (send_all(sockfd_out, history.chunks[offset / HISTORY_CHUNK_SIZE] + offset % HISTORY_CHUNK_SIZE,
+                     send_len) == RET_FAILURE)
+        {
+            rc = RET_FAILURE;
+            break;
+        }
+        offset += send_len;
+    }
+    setsockopt(sockfd_out, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    return rc;
+}
+
+// Frees the history; only once no worker can be sending from it
+void history_free()
+{
+    size_t i;
+
+    for (i = 0; i < history.max_chunks; i++)
+        free(history.chunks[i]);
+    free(history.chunks);
+    memset(&history, 0, sizeof(history));
+}
+
+/*************************************************************************
+ *                    Metrics Endpoint Functions                         *
+ *************************************************************************/
+
+// Sum of one counter over all thread slots
+unsigned long long metric_sum(size_t field_offset)
+{
+    unsigned long long sum = 0;
+    int i;
+
+    for (i = 0; i <= num_workers; i++)
+        sum += atomic_load_explicit((atomic_ullong *)((char *)&metrics[i] + field_offset), memory_order_relaxed);
+    return sum;
+}
+
+#define METRIC_SUM(field)  metric_sum(offsetof(thread_metrics_t, field))
+
+// Writes one counter or gauge with its HELP and TYPE lines
+void write_metric(FILE *out, const char *name, const char *type, const char *help, unsigned long long value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, value);
+}
+
+// Ref: [39] Prometheus text format
+// Formats every metric into out. Counters are summed over the slots without stopping the threads, so a
+// scrape may see one counter a few increments ahead of another; each counter never goes backwards.
+void write_metrics(FILE *out)
+{
+    unsigned long long accepted, closed, cumulative = 0;
+    long long data_size;
+    int open_connections, i;
+    int fd;
+
+    accepted = METRIC_SUM(connections_accepted);
+    closed = METRIC_SUM(connections_closed);
+
+    pthread_mutex_lock(&conn_lock);
+    open_connections = num_connections;
+    pthread_mutex_unlock(&conn_lock);
+
+    #ifdef USE_AESD_CHAR_DEVICE
+    // The driver reports the bytes it holds through lseek(SEEK_END)
+    data_size = -1;
+    if ((fd = open(DATA_FILE, O_RDONLY | O_CLOEXEC)) != RET_FAILURE)
+    {
+        data_size = lseek(fd, 0, SEEK_END);
+        close(fd);
+    }
+    #else
+    (void)fd;
+    pthread_mutex_lock(&lock);
+    data_size = data_len;
+    pthread_mutex_unlock(&lock);
+    #endif
+
+    write_metric(out, "aesdsocket_connections_accepted_total", "counter", "Client connections accepted.", accepted);
+    write_metric(out, "aesdsocket_connections_closed_total", "counter", "Client connections closed.", closed);
+    write_metric(out, "aesdsocket_connections_open", "gauge", "Client connections open now.", open_connections);
+    write_metric(out, "aesdsocket_connections_max", "gauge", "Open connections before accepting pauses.",
+                 max_connections);
+    write_metric(out, "aesdsocket_received_bytes_total", "counter", "Bytes received from clients.",
+                 METRIC_SUM(bytes_in));
+    write_metric(out, "aesdsocket_sent_bytes_total", "counter", "Bytes sent to clients.", METRIC_SUM(bytes_out));
+    write_metric(out, "aesdsocket_lines_total", "counter", "Lines processed, commands included.", METRIC_SUM(lines));
+    write_metric(out, "aesdsocket_ioctl_seeks_total", "counter", "AESDCHAR_IOCSEEKTO commands.",
+                 METRIC_SUM(ioctl_seeks));
+    write_metric(out, "aesdsocket_since_requests_total", "counter", "SINCE commands.", METRIC_SUM(since_requests));
+    write_metric(out, "aesdsocket_lock_acquired_total", "counter", "Acquisitions of the DATA_FILE append lock.",
+                 METRIC_SUM(lock_acquired));
+    write_metric(out, "aesdsocket_lock_contended_total", "counter", "Acquisitions that had to wait.",
+                 METRIC_SUM(lock_contended));
+    fprintf(out, "# HELP aesdsocket_lock_wait_seconds_total Time spent waiting for the DATA_FILE append lock.\n"
+                 "# TYPE aesdsocket_lock_wait_seconds_total counter\n"
+                 "aesdsocket_lock_wait_seconds_total %.9f\n", METRIC_SUM(lock_wait_ns) / 1e9);
+    if (data_size >= 0)
+        write_metric(out, "aesdsocket_data_file_bytes", "gauge", "Bytes held by DATA_FILE.", data_size);
+
+    fprintf(out, "# HELP aesdsocket_reply_latency_seconds Time from a complete line to its reply being sent.\n"
+                 "# TYPE aesdsocket_reply_latency_seconds histogram\n");
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        cumulative += METRIC_SUM(latency_bucket[i]);
+        if (i < LATENCY_BUCKETS - 1)
+            fprintf(out, "aesdsocket_reply_latency_seconds_bucket{le=\"%g\"} %llu\n", (double)(1ULL << i) / 1e6,
+                    cumulative);
+        else
+            fprintf(out, "aesdsocket_reply_latency_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+    }
+    fprintf(out, "aesdsocket_reply_latency_seconds_sum %.9f\n", METRIC_SUM(latency_ns) / 1e9);
+    fprintf(out, "aesdsocket_reply_latency_seconds_count %llu\n", cumulative);
+}
+
+// Answers one scrape on clientfd. The request is read up to its blank line (or a plain "\n" from nc) so
+// closing the socket afterwards does not reset the connection, then the metrics go out as HTTP/1.0.
+void serve_metrics(int clientfd)
+{
+    struct timeval timeout = { METRICS_REQUEST_TIMEOUT, 0 };
+    char request[BUFFER_SIZE];
+    size_t request_len = 0;
+    ssize_t num_bytes;
+    char *body = NULL, header[BUFFER_SIZE];
+    size_t body_len = 0;
+    FILE *out;
+
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (request_len < sizeof(request) - 1 &&
+           (num_bytes = recv(clientfd, request + request_len, sizeof(request) - 1 - request_len, 0)) > 0)
+    {
+        request_len += num_bytes;
+        request[request_len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL || strcmp(request, "\n") == 0)
+            break;
+    }
+
+    // Ref: [40] man page
+    // FILE *open_memstream(char **ptr, size_t *sizeloc);
+    if ((out = open_memstream(&body, &body_len)) == NULL)
+        return;
+    write_metrics(out);
+    fclose(out);
+
+    send_all(clientfd, header, snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_len));
+    send_all(clientfd, body, body_len);
+    free(body);
+}
+
+// Metrics thread: one scrape at a time, so scrapes never take a worker away from clients
+void *metrics_handler(void *arg)
+{
+    int clientfd;
+
+    while (true)
+    {
+        // Blocks until a scrape arrives; cleanup() shuts metrics_sockfd down, which makes accept() fail
+        clientfd = accept4(metrics_sockfd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientfd == RET_FAILURE)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        serve_metrics(clientfd);
+        close(clientfd);
+    }
+    return NULL;
+}
+
+// Listens on 127.0.0.1:metrics_port and starts the metrics thread. On failure metrics_sockfd is closed and
+// left at -1, so cleanup() has nothing to stop.
+int start_metrics()
+{
+    struct sockaddr_in addr;
+    int yes = 1;
+
+    metrics_sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metrics_sockfd == RET_FAILURE)
+        return RET_FAILURE;
+
+    // Ref: [6] man page, [11] man page
+    setsockopt(metrics_sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(metrics_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);                          // Local scrapers only
+
+    if (bind(metrics_sockfd, (struct sockaddr *)&addr, sizeof(addr)) == RET_FAILURE ||
+        listen(metrics_sockfd, LISTEN_BACKLOG) == RET_FAILURE ||
+        pthread_create(&metrics_thread, NULL, metrics_handler, NULL) != SUCCESS)
+    {
+        close(metrics_sockfd);
+        metrics_sockfd = -1;
+        return RET_FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*************************************************************************
+ *                      Process Packet Function                          *
+ *************************************************************************/
+
+// DATA_FILE for the calling worker. In file mode every worker shares data_fd: appends are O_APPEND writes
+// under lock and replies read at explicit offsets. The driver keeps state per open file (the position set
+// by AESDCHAR_IOCSEEKTO, a pending partial line), so with aesdchar each worker opens its own fd once and
+// keeps it, in place of an open()/close() per line.
+int data_file()
+{
+    #ifdef USE_AESD_CHAR_DEVICE
+    if (device_fd == -1 && (device_fd = open(DATA_FILE, O_RDWR | O_CLOEXEC)) == RET_FAILURE)
+    {
+        LOG_MSG(LOG_ERR,"Error while opening given file; open() failure\n");
+    }
+    return device_fd;
+    #else
+    return data_fd;
+    #endif
+}
+
+// Called after a connection's unterminated last line was written. With aesdchar that line stays pending on
+// the worker's fd and would be joined to the next line the worker writes, from whichever client. Closing
+// the fd hands it to the driver like any file closed mid-line, as when every line used its own open();
+// the next data_file() opens a fresh fd. Nothing to do in file mode, where the bytes are already appended.
+void release_data_file()
+{
+    #ifdef USE_AESD_CHAR_DEVICE
+    if (device_fd != -1)
+    {
+        close(device_fd);
+        device_fd = -1;
+    }
+    #endif
+}
+
+// Current length of DATA_FILE; caller holds lock
+off_t data_file_end(int fd)
+{
+    #ifdef USE_AESD_CHAR_DEVICE
+    return lseek(fd, 0, SEEK_END);                   // Moves only this worker's position, which is not used
+    #else
+    return data_len;
+    #endif
+}
+
+// Handles SINCE:<since> on fd. The current end of DATA_FILE is taken under lock like the snapshot of a
+// data packet, then "SINCE:<end>\n" and the bytes from since up to end are sent. A since past the end only
+// gets the header. With /dev/aesdchar, offsets count from the oldest entry the driver still holds, as for
+// lseek().
+void process_since(client_conn_t *conn, int fd, unsigned long long since)
+{
+    char header[BUFFER_SIZE];
+    bool from_cache;
+    off_t end;
+    int on = 1, off = 0;
+    int rc;
+
+    METRIC_ADD(since_requests, 1);
+
+    lock_data();
+    end = data_file_end(fd);
+    from_cache = history.enabled && !history.full && history.len == (size_t)end;
+    pthread_mutex_unlock(&lock);
+
+    if (end == RET_FAILURE)
+    {
+        LOG_MSG(LOG_ERR,"Error while seeking given file; lseek() failure\n");
+        return;
+    }
+    if (since > (unsigned long long)end)
+        since = end;
+
+    // Ref: [34] man page
+    // Corked so the header leaves in the same segment as the first data
+    setsockopt(conn->newfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    rc = send_all(conn->newfd, header, snprintf(header, sizeof(header), "%s%lld\n", SINCE_STRING, (long long)end));
+    if (rc == SUCCESS && since < (unsigned long long)end)
+    {
+        if (from_cache)
+            rc = history_send(conn->newfd, since, end);
+        else
+            rc = send_file(conn->newfd, fd, since, end - since);
+    }
+    setsockopt(conn->newfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+
+    if (rc == RET_FAILURE)
+        LOG_MSG(LOG_ERR,"Error while sending to %s; send() failure\n", conn->ip_address);
+    else
+        LOG_MSG(LOG_DEBUG,"Send success from offset %llu!\n", since);
+}
+
+// Handles one complete line of len bytes, newline included and NUL terminated: either an
+// AESDCHAR_IOCSEEKTO command or data appended to DATA_FILE, then returns the contents of DATA_FILE to the
+// client. SINCE:<offset> is handed to process_since().
+//
+// Only the append phase holds lock: the packet is written and the resulting length of DATA_FILE is
+// recorded as the reply snapshot. The reply then streams the first snapshot bytes without the lock, so
+// a slow client never stalls writers or other readers. DATA_FILE is append only, so those bytes cannot
+// change underneath the reply; /dev/aesdchar serializes each read() in the driver itself.
+//
+// While the history cache still mirrors DATA_FILE, the reply comes from memory and DATA_FILE is not
+// read at all.
+void process_packet(client_conn_t *conn, const char *line, size_t len)
+{
+	/*************************************************************************
+     *                            Receive                                    *
+     *************************************************************************/
+    struct aesd_seekto seekto;
+    off_t offset = 0;                                // Where the reply starts in DATA_FILE
+    size_t snapshot;                                 // Bytes of DATA_FILE the reply covers
+    unsigned long long since;
+    bool from_cache = false;                         // Reply from the history cache instead of DATA_FILE
+    ssize_t written;
+    int fd;
+
+ 	unsigned int write_cmd, write_cmd_offset;
+
+    if ((fd = data_file()) == RET_FAILURE)
+        return;
+
+    // ioctl check
+    // int strncmp(const char s1[.n], const char s2[.n], size_t n);
+    if ((strncmp(line, IOCTL_STRING, IOCTL_STRING_LENGTH )) == SUCCESS)
+    {
+        sscanf(line, "AESDCHAR_IOCSEEKTO:%u,%u", &write_cmd, &write_cmd_offset);
+        seekto.write_cmd = write_cmd;
+        seekto.write_cmd_offset = write_cmd_offset;
+
+        // Seeks only move the file position of this worker's fd; the driver locks, lock is not needed
+    	if(ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
+        {
+        	LOG_MSG(LOG_ERR,"Error while ioctl; ioctl failure, errno %d\n", errno);
+			return;
+        }
+        LOG_MSG(LOG_DEBUG,"IOCTL success!\n");
+        METRIC_ADD(ioctl_seeks, 1);
+        offset = lseek(fd, 0, SEEK_CUR);
+        snapshot = SIZE_MAX;                         // From the seek position to the end
+    }
+    else if (strncmp(line, SINCE_STRING, SINCE_STRING_LENGTH) == SUCCESS &&
+             sscanf(line, "SINCE:%llu", &since) == 1)
+    {
+        process_since(conn, fd, since);
+        return;
+    }
+    else
+    {
+        lock_data();
+
+    	// Ref: [13] man page
+        // Received data written to file
+        // size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream);
+        if ((written = write(fd, line, len)) == RET_FAILURE)
+        {
+            LOG_MSG(LOG_ERR,"Error while writing to given file; write() failure\n");
+        }
+        else
+        {
+            LOG_MSG(LOG_DEBUG,"Write success!, received data written to file\n");
+            #ifndef USE_AESD_CHAR_DEVICE
+            data_len += written;
+            #endif
+            history_append(line, written);
+        }
+
+        // Snapshot: everything up to and including this packet
+        snapshot = data_file_end(fd);
+
+        // The cache can serve it only if it holds every byte of DATA_FILE, e.g. not after a short write
+        from_cache = history.enabled && !history.full && history.len == snapshot;
+
+        pthread_mutex_unlock(&lock);
+    }
+
+     /*************************************************************************
+      *                            Send                                       *
+      *************************************************************************/
+
+    // Returns the content of DATA_FILE to the client as soon as the received data packet completes.
+    if (from_cache)
+    {
+        if (history_send(conn->newfd, 0, snapshot) == RET_FAILURE)
+            LOG_MSG(LOG_ERR,"Error while sending to %s; send() failure\n", conn->ip_address);
+        else
+            LOG_MSG(LOG_DEBUG,"Send success from history cache!\n");
+        return;
+    }
+
+    // Returns data to client newfd
+    if (send_file(conn->newfd, fd, offset, snapshot) == RET_FAILURE)
+        LOG_MSG(LOG_ERR,"Error while sending to %s; send() failure\n", conn->ip_address);
+    else
+        LOG_MSG(LOG_DEBUG,"Send success!\n");
+}
+
+/*************************************************************************
+ *                  Service Connection Function                          *
+ *************************************************************************/
+
+// Runs process_packet() on every complete line in the packet buffer, in order, then moves the partial
+// line that is left (if any) to the front. At end of stream (eof) that partial line is processed too.
+//
+// Ref: [14] man page
+// glibc's memchr() is vectorized; scan_len keeps a long line arriving in small pieces from being
+// searched again from its start on every recv()
+void process_lines(client_conn_t *conn, bool eof)
+{
+    char *line = conn->packet, *newline;
+    char *end = conn->packet + conn->packet_len;
+    struct timespec start;
+    size_t len;
+    char saved;
+
+    if (conn->packet == NULL)
+        return;                                                              // Nothing received yet
+
+    // void *memchr(const void s[.n], int c, size_t n);
+    while ((newline = memchr(line + conn->scan_len, '\n', end - line - conn->scan_len)) != NULL)
+    {
+        len = newline + 1 - line;
+
+        // NUL terminate the line for sscanf without losing the first byte of the next one; append_packet()
+        // keeps a spare byte after the buffer for the last line
+        saved = line[len];
+        line[len] = '\0';
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        process_packet(conn, line, len);
+        observe_latency(&start);
+        METRIC_ADD(lines, 1);
+        line[len] = saved;
+
+        line += len;
+        conn->scan_len = 0;
+    }
+
+    // Client closed without a final '\n'; handle whatever was received
+    if (eof && line < end)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        process_packet(conn, line, end - line);
+        observe_latency(&start);
+        METRIC_ADD(lines, 1);
+        release_data_file();
+        line = end;
+    }
+
+    conn->packet_len = end - line;
+    conn->scan_len = conn->packet_len;
+    memmove(conn->packet, line, conn->packet_len);
+    if (conn->packet != NULL)
+        conn->packet[conn->packet_len] = '\0';
+}
+
+// Called by a worker when epoll reported the connection readable. Edge triggered, so the socket is
+// drained until recv() returns EAGAIN. Every '\n' ends a line that gets its own reply, in the order
+// received, however the lines were split across recv() calls. The connection stays open for further lines
+// until the client closes it.
+void service_connection(client_conn_t *conn)
+{
+    char buffer[BUFFER_SIZE];
+ 	ssize_t num_bytes;
+
+    while (true)
+    {
+        // Ref: [12] man page
+        // receive - returns the number of bytes actually read into the buffer
+        // int recv(int sockfd, void *buf, int len, int flags);
+        num_bytes = recv(conn->newfd, buffer, sizeof(buffer), 0);
+        if (num_bytes > 0)
+        {
+            LOG_MSG(LOG_DEBUG,"Recv success!\n");
+            METRIC_ADD(bytes_in, num_bytes);
+            if (append_packet(conn, buffer, num_bytes) == RET_FAILURE)
+            {
+                LOG_MSG(LOG_ERR,"Error storing packet from %s; realloc() failure\n", conn->ip_address);
+                close_connection(conn);
+                return;
+            }
+            process_lines(conn, false);
+        }
+        else if (num_bytes == 0)
+        {
+            // A partial line of a connection closed for being idle is dropped, not stored
+            if (!atomic_load(&conn->expired))
+                process_lines(conn, true);
+            close_connection(conn);
+            return;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // Drained; wait for more lines
+            if (rearm_connection(conn) == RET_FAILURE)
+            {
+                LOG_MSG(LOG_ERR,"Error re-arming connection; epoll_ctl() failure\n");
+                close_connection(conn);
+            }
+            return;
+        }
+        else
+        {
+            LOG_MSG(LOG_ERR,"Error receiving from %s; recv() failure\n", conn->ip_address);
+            close_connection(conn);
+            return;
+        }
+    }
+}
+
+/*************************************************************************
+ *                  Worker_handler Function                              *
+ *************************************************************************/
+
+void *worker_handler(void *arg)
+{
+    client_conn_t *conn;
+
+    metrics_self = arg;                                                      // This worker's counters
+    log_self = &log_rings[metrics_self - metrics];                           // ... and log ring
+
+    while (true)
+    {
+        pthread_mutex_lock(&work_lock);
+
+        // Ref: [27] man page
+        // int pthread_cond_wait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex);
+        while (STAILQ_EMPTY(&work_head) && !worker_exit)
+            pthread_cond_wait(&work_cond, &work_lock);
+
+        if (worker_exit)
+        {
+            pthread_mutex_unlock(&work_lock);
+            break;
+        }
+
+        // STAILQ_REMOVE_HEAD(head, field)
+        conn = STAILQ_FIRST(&work_head);
+        STAILQ_REMOVE_HEAD(&work_head, work_entries);
+        pthread_mutex_unlock(&work_lock);
+
+        service_connection(conn);
+    }
+
+    if (device_fd != -1)
+        close(device_fd);
+    free(reply_buffer);
+    return NULL;
+}
+
+// Hands a readable connection to the worker pool
+void queue_connection(client_conn_t *conn)
+{
+    atomic_store(&conn->busy, true);
+
+    pthread_mutex_lock(&work_lock);
+
+    // STAILQ_INSERT_TAIL(head, elm, field)
+    STAILQ_INSERT_TAIL(&work_head, conn, work_entries);
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&work_lock);
+}
+
+// Runs on every idle_timerfd expiry. Connections silent for idle_timeout seconds are shut down rather
+// than closed: the resulting EOF makes a worker close them through the usual path, so the event loop never
+// frees a connection a worker could still be holding. Connections with a worker are not idle.
+void expire_idle_connections()
+{
+    client_conn_t *conn;
+    uint64_t expirations;
+    long now = monotonic_seconds();
+
+    // Ref: [36] man page
+    // Reading resets the timerfd's readiness; the count of missed ticks is not needed
+    if (read(idle_timerfd, &expirations, sizeof(expirations)) == RET_FAILURE)
+        return;
+
+    pthread_mutex_lock(&conn_lock);
+    LIST_FOREACH(conn, &conn_head, entries)
+    {
+        if (atomic_load(&conn->busy) || atomic_load(&conn->expired) ||
+            now - atomic_load(&conn->last_active) < idle_timeout)
+            continue;
+
+        atomic_store(&conn->expired, true);
+        LOG_MSG(LOG_INFO,"Closing idle connection from %s\n", conn->ip_address);
+
+        // Ref: [37] man page
+        shutdown(conn->newfd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn_lock);
+}
+
+// Creates idle_timerfd, ticking every IDLE_CHECK_INTERVAL seconds, and adds it to epoll
+int start_idle_timer()
+{
+    struct itimerspec interval = { { IDLE_CHECK_INTERVAL, 0 }, { IDLE_CHECK_INTERVAL, 0 } };
+    struct epoll_event event;
+
+    // Ref: [36] man page
+    // int timerfd_create(int clockid, int flags);
+    idle_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (idle_timerfd == RET_FAILURE)
+        return RET_FAILURE;
+
+    // int timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value);
+    if (timerfd_settime(idle_timerfd, 0, &interval, NULL) == RET_FAILURE)
+        return RET_FAILURE;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &idle_timerfd;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, idle_timerfd, &event);
+}
+
+/*************************************************************************
+ *                    Accept Connections Function                        *
+ *************************************************************************/
+
+// sockfd is non-blocking and edge triggered, so accept until the kernel queue is empty
+void accept_connections()
+{
+    struct sockaddr_in clientaddr;
+    socklen_t clientaddrlen;
+    struct epoll_event event;
+    client_conn_t *conn;
+    int newfd;
+
+    while (true)
+    {
+        // Backpressure: stop taking clients off the listen backlog until a connection closes
+        pthread_mutex_lock(&conn_lock);
+        if (num_connections >= max_connections)
+        {
+            set_accepting(false);
+            pthread_mutex_unlock(&conn_lock);
+            return;
+        }
+        pthread_mutex_unlock(&conn_lock);
+
+        //Ref: [26] man page, [1] beej guide
+        // accept4 - accept a connection on a socket, setting flags on the new fd
+        // int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+        clientaddrlen = sizeof(clientaddr);
+        newfd = accept4(sockfd, (struct sockaddr *)&clientaddr, &clientaddrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newfd == RET_FAILURE)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;                                                                 // Queue drained
+
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
 
-#define USE_AESD_CHAR_DEVICE              // comment out of not req
+            LOG_MSG(LOG_ERR,"Error accepting a connection on a socket; accept() failure\n");
+            return;
+        }
+        LOG_MSG(LOG_DEBUG,"Success: accept()\n");
 
-#ifdef USE_AESD_CHAR_DEVICE
-    #define DATA_FILE                     ("/dev/aesdchar")
-#else
-    #define DATA_FILE                     ("/var/tmp/aesdsocketdata")
-#endif
+        conn = (client_conn_t *) calloc(1, sizeof(client_conn_t)); // Allocate memory for new client node
+        if (conn == NULL)
+        {
+            LOG_MSG(LOG_ERR,"Error allocating connection; calloc() failure\n");
+            close(newfd);
+            continue;
+        }
+        conn->newfd = newfd;                                       // Load fd value
+        METRIC_ADD(connections_accepted, 1);
+        atomic_store(&conn->last_active, monotonic_seconds());
 
-#define BUFFER_SIZE                       (1024)
+        //Logs message to the syslog “Accepted connection from xxx” where XXXX is the IP address of the connected client.
+        // Ref: [10], [11] man pages
+        /*
+           struct sockaddr_in {
+           sa_family_t     sin_family;     // AF_INET
+           in_port_t       sin_port;       // Port number
+           struct in_addr  sin_addr;       // IPv4 address
+           };
+        */
+        // Get the IP address as a string; inet_ntop, since inet_ntoa's static buffer is not thread safe
+        inet_ntop(AF_INET, &clientaddr.sin_addr, conn->ip_address, sizeof(conn->ip_address));
+        LOG_MSG(LOG_INFO,"Accepted connection from %s\n", conn->ip_address);
 
-// Ref: [22] man page
-#define RFC2822_compliant_strftime_format ("%a, %d %b %Y %T %z\n")
+        // LIST_INSERT_HEAD(head, elm, field)
+        pthread_mutex_lock(&conn_lock);
+        LIST_INSERT_HEAD(&conn_head, conn, entries);                // Insert element at head
+        num_connections++;
+        pthread_mutex_unlock(&conn_lock);
 
-#define IOCTL_STRING                      ("AESDCHAR_IOCSEEKTO:")
-#define IOCTL_STRING_LENGTH               (19)
+        // Ref: [25] man page
+        // EPOLLONESHOT: disarmed after one event until the worker re-arms it
+        event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        event.data.ptr = conn;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, newfd, &event) == RET_FAILURE)
+        {
+            LOG_MSG(LOG_ERR,"Error adding connection to epoll; epoll_ctl() failure\n");
+            close_connection(conn);
+        }
+    }
+}
 
 /*************************************************************************
- *                  Global Variables                                     *
+ *                    Cleanup Function                                   *
  *************************************************************************/
- 
-int sockfd;                                       // Socket function return val
-FILE *file_ptr;                                   // fopen return val
-char* ip_address;                                 // inet_ntoa return val
 
-pthread_mutex_t lock;                             // For writing to DATA_FILE and timestamp   
-bool signal_exit = false;                         // Flag to indicate signal detected
-bool timer_exit  = false;                         // Flag to indicate timer end
+void cleanup()
+{
+    client_conn_t *conn, *temp;
+    int i;
 
-/*************************************************************************
- *                        Structures                                     *
- *************************************************************************/
-// Ref: [20] man page
-// timespec - time in seconds and nanoseconds
-// Member obj: time_t tv_sec, tv_nsec
-struct timespec time_now, time_sleep = {10, 0};  // For timestamp after 10 sec, 0 nanosec
+    syslog(LOG_INFO, "Caught signal, exiting");
 
-// Ref: [21] man page
-// tm - broken-down time
-/* struct tm {
-	int         tm_sec;    // Seconds          [0, 60] 
-    int         tm_min;    // Minutes          [0, 59] 
-    int         tm_hour;   // Hour             [0, 23] 
-    int         tm_mday;   // Day of the month [1, 31] 
-    int         tm_mon;    // Month            [0, 11]  (January = 0)
-    int         tm_year;   // Year minus 1900 
-    int         tm_wday;   // Day of the week  [0, 6]   (Sunday = 0) 
-    int         tm_yday;   // Day of the year  [0, 365] (Jan/01 = 0) 
-    int         tm_isdst;  // Daylight savings flag 
+    // Wake workers blocked sending to a client, then stop the pool
+    pthread_mutex_lock(&conn_lock);
+    LIST_FOREACH(conn, &conn_head, entries)
+    {
+        shutdown(conn->newfd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn_lock);
 
-    long        tm_gmtoff; // Seconds East of UTC 
-    const char *tm_zone;   // Timezone abbreviation 
-}; */
-struct tm time_info;                                // time info in tm
-  
-// Ref: [17] sample.c, queue.h
-// Singly Linked List
-/*
-#define	SLIST_ENTRY(type)						\
-struct {								        \
-	struct type *sle_next;	// next element     \
-}*/
-typedef struct slist_client_s slist_client_t;
-struct slist_client_s 
-{
-    pthread_t thread_id;                            // Track thread Id
-    bool thread_completion_flag;                    // Check for completion
-    int newfd;                                      // File descriptor of new client connection
-    SLIST_ENTRY(slist_client_s) entries;
-};
+    pthread_mutex_lock(&work_lock);
+    worker_exit = true;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&work_lock);
 
-/* SLIST_HEAD(name, type)
-struct name {								   \
-	struct type *slh_first;	// first element   \
-}*/
-SLIST_HEAD(slisthead, slist_client_s) head;        // Head of LL
+    for (i = 0; i < num_workers; i++)
+    {
+        pthread_join(worker_threads[i], NULL);
+    }
+    free(worker_threads);
 
-struct slist_client_s *temp;                       // SLIST_FOREACH_SAFE function arg
+    if (metrics_sockfd != -1)
+    {
+        // Ref: [37] man page
+        shutdown(metrics_sockfd, SHUT_RDWR);
+        pthread_join(metrics_thread, NULL);
+        close(metrics_sockfd);
+    }
+    metrics_self = NULL;
+    free(metrics);
+
+    // Ref: [17] queue.h
+    /*
+    #define	LIST_FOREACH_SAFE(var, head, field, tvar)			\
+	for ((var) = LIST_FIRST((head));				            \
+	    (var) && ((tvar) = LIST_NEXT((var), field), 1);		    \
+	    (var) = (tvar))*/
+    LIST_FOREACH_SAFE(conn, &conn_head, entries, temp)
+    {
+        close_connection(conn);
+    }
+    if (idle_timerfd != -1)
+        close(idle_timerfd);
+    close(epollfd);
+    close(sockfd);
+
+    // Workers are gone and timestamps are written by this thread, so nothing else uses the history
+    history_free();
+    if (timestamp_timerfd != -1)
+        close(timestamp_timerfd);
+    if (data_fd != -1)
+        close(data_fd);
 
-/*************************************************************************
- *                    Cleanup Function                                   *
- *************************************************************************/
- 
-void cleanup()
-{
     // Gracefully exits when SIGINT or SIGTERM is received, completing any open connection operations, closing any open sockets, and deleting the file /var/tmp/aesdsocketdata
 	#ifndef USE_AESD_CHAR_DEVICE
     remove(DATA_FILE);
     #endif
 
-        
-    syslog(LOG_INFO, "Caught signal, exiting");               
+    // Everything still queued by the workers and the event loop goes out before exiting
+    log_stop();
+
+    syslog(LOG_INFO, "Program completed successfully!");
     closelog();
-    
-    struct slist_client_s *new_client_node;
-    
-    // Ref: [17] queue.h
-    /*
-    #define	SLIST_FOREACH_SAFE(var, head, field, tvar)			\
-	for ((var) = SLIST_FIRST((head));				            \
-	    (var) && ((tvar) = SLIST_NEXT((var), field), 1);		\
-	    (var) = (tvar))*/
-    SLIST_FOREACH_SAFE(new_client_node, &head, entries, temp)
-    {
-        pthread_join(new_client_node->thread_id, NULL);
-        SLIST_REMOVE(&head, new_client_node, slist_client_s, entries);
-        free(new_client_node);
-    }
-    syslog(LOG_INFO, "Program completed successfully!"); 
-    printf("Program completed successfully!"); 
+    printf("Program completed successfully!");
     exit(SUCCESS);
 }
 
 /*************************************************************************
  *             Signal Handler Function                                   *
  *************************************************************************/
- 
+
+// Only sets the flag; SIGINT and SIGTERM are unblocked solely inside epoll_pwait() in main, which then
+// returns EINTR and lets main run cleanup()
 void signalhandler (int signal)
-{ 
+{
 
     if (signal == SIGINT || signal == SIGTERM )
-    {   
+    {
         signal_exit = true;
-        
-    	shutdown(sockfd, SHUT_RDWR);
-    	cleanup();
-    }   
+    }
 }
 
 /*************************************************************************
- *               Time Handler Function                                   *
+ *                    Timestamp Functions                                *
  *************************************************************************/
 #ifndef USE_AESD_CHAR_DEVICE
-void timehandler(int signal)
-{ 
-    if (signal == SIGALRM)
-    {          
-        timer_exit = true;
-    }   
+// Arms timestamp_timerfd with absolute CLOCK_REALTIME deadlines every TIMESTAMP_INTERVAL seconds from now.
+// The first deadline is already due, so a timestamp is written right away. Absolute periodic deadlines do
+// not drift however late the event loop gets to an expiry.
+int arm_timestamp_timer()
+{
+    struct itimerspec deadlines = { { TIMESTAMP_INTERVAL, 0 }, { 0, 0 } };
+
+    // Ref: [23] man page
+    clock_gettime(CLOCK_REALTIME, &deadlines.it_value);
+
+    // Ref: [36] man page
+    // TFD_TIMER_CANCEL_ON_SET: a change of the wall clock makes read() fail with ECANCELED, so the
+    // deadlines can be moved to the new time
+    return timerfd_settime(timestamp_timerfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &deadlines, NULL);
 }
-#endif
 
-/*************************************************************************
- *                  Multithread_handler Function                         *
- *************************************************************************/
- 
-void *multithread_handler(void *new_client_node)
+// Creates the timestamp timer and adds it to epoll
+int start_timestamp_timer()
 {
-	struct slist_client_s *thread_param = (struct slist_client_s*)new_client_node;
-	
-	/*************************************************************************
-     *                            Receive                                    *
-     *************************************************************************/ 
-     int fd;
-    // Receives data over the connection and appends to file 
-    
-    //if ((file_ptr = fopen(DATA_FILE, "a+")) == NULL) //opens file in append and update mode and checks if error
-    if ((fd = open(DATA_FILE, O_CREAT | O_RDWR | O_APPEND, 0744)) == -1) //opens file checks if error
-    {
-        syslog(LOG_ERR,"Error while opening given file; fopen() failure\n"); //syslog error
-		printf("Error! fopen() failure\n"); //prints error
-		perror("");
-		pthread_mutex_unlock(&lock);
-		close(thread_param->newfd);
-        thread_param->thread_completion_flag = 1;
-		return NULL;
-    }
-    printf("Opened DATA_FILE: %s for receive\n", DATA_FILE);
-    char buffer[BUFFER_SIZE];
-    struct aesd_seekto seekto;
-    off_t offset;
-    
- 	int num_bytes;
- 	unsigned int write_cmd, write_cmd_offset;
-
-    // Ref: [12] man page
-    // receive - returns the number of bytes actually read into the buffer
-    // int recv(int sockfd, void *buf, int len, int flags);
-    while ((num_bytes = recv( thread_param->newfd, buffer, sizeof( buffer), 0)) > 0)
-    {
-    	printf("Recv success!\n");
-        pthread_mutex_lock(&lock);
-        
-        // ioctl check
-    	// int strncmp(const char s1[.n], const char s2[.n], size_t n);
-    	if ((strncmp(buffer, IOCTL_STRING, IOCTL_STRING_LENGTH )) == SUCCESS)
-    	{
-            sscanf(buffer, "AESDCHAR_IOCSEEKTO:%u,%u", &write_cmd, &write_cmd_offset);
-            seekto.write_cmd = write_cmd;
-            seekto.write_cmd_offset = write_cmd_offset;
-
-    		if(ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
-        	{
-        		syslog(LOG_ERR,"Error while ioctl; ioctl failure\n"); //syslog error
-				printf("Error! ioctl() failure\n"); //prints error
-				pthread_mutex_unlock(&lock);
-				perror("");
-				return NULL;
-        	}
-        	printf("IOCTL success!\n");
-            offset = lseek(fd, 0, SEEK_CUR);
-        }
-        else
-        {
-    	    // Ref: [13] man page
-        	// Received data written to file
-        	// size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream);
-        	write(fd, buffer, num_bytes);
-        	printf("Write success!, received data written to file\n");
-        	
-        	offset = -1; // flag write occured
-        	
-        	close(fd);    
-    		printf("Closed DATA_FILE: %s after receive\n", DATA_FILE); 
-        }
+    struct epoll_event event;
 
-        pthread_mutex_unlock(&lock);
-        printf("Unlocked after receive!\n");
+    // int timerfd_create(int clockid, int flags);
+    timestamp_timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timestamp_timerfd == RET_FAILURE || arm_timestamp_timer() == RET_FAILURE)
+        return RET_FAILURE;
 
-        // Ref: [14] man page
-        // memchr - Scan memory for a character
-        // void *memchr(const void s[.n], int c, size_t n);
-        if (memchr(buffer, '\n', num_bytes) != NULL) // check '\n' in the received data. If so break out of loop, indicating end of a data packet
-        {
-            printf("NULL detected; end of packet!\n");
-            break;
-        }
-    }
-     /*************************************************************************
-      *                            Send                                       *
-      *************************************************************************/ 
-    pthread_mutex_lock(&lock);
-    printf("Locked for send!\n");
-    
-    // Returns the full content of DATA_FILE to the client as soon as the received data packet completes.
-    if (offset == -1 && (fd = open(DATA_FILE, O_RDWR)) == -1)  //opens file in read mode and checks if error
-    {
-        syslog(LOG_ERR,"Error while opening given file; fopen() failure\n");      //syslog error
-		printf("Error! fopen() failure in send function\n");                                       //prints error
-		pthread_mutex_unlock(&lock);
-        thread_param->thread_completion_flag = 1;
-		return NULL;
-    }
-    printf("Opened DATA_FILE: %s for send\n", DATA_FILE);
-       
-    // Ref: [15] man page
-    // Reads data from file
-    // ssize_t read(int fd, void buf[.count], size_t count); 
-    ssize_t read_bytes;
-    while ((read_bytes = read(fd, buffer, sizeof(buffer))) > 0)
-    {
-        // Ref: [16] man page
-        // Returns data to client newfd
-        // ssize_t send(int sockfd, const void buf[.len], size_t len, int flags);
-        send(thread_param->newfd, buffer, read_bytes, 0);
-    }
-    printf("Send success!\n");
-	   
-    close(thread_param->newfd);
-    close(fd); 
-    printf("Closed DATA_FILE: %s after send\n", DATA_FILE); 
-    pthread_mutex_unlock(&lock);
-    printf("Unlocked after send!\n");
-    thread_param->thread_completion_flag = 1;
-    return NULL;
+    event.events = EPOLLIN;
+    event.data.ptr = &timestamp_timerfd;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, timestamp_timerfd, &event);
 }
 
-/*************************************************************************
- *                 timestamp_handler Function                         *
- *************************************************************************/
-#ifndef USE_AESD_CHAR_DEVICE
-void *timestamp_handler (void *arg)
+// Runs on every timestamp_timerfd expiry: formats the RFC 2822 line once and appends it with one write().
+// Expiries missed while the event loop was busy are folded into this one timestamp.
+void write_timestamp()
 {
     char buffer[BUFFER_SIZE];                                                           // To store formatted time and date
+    uint64_t expirations;
+    size_t len;
 
-    while (!timer_exit)
-    {
-        // Ref: [23] man page
-        // clock_gettime(clockid_t clockid, struct timespec *tp);
-        clock_gettime(CLOCK_REALTIME, &time_now);                                        // Get current time with nanosec
-        
-        // Ref: [24] man page
-        // struct tm *localtime_r(const time_t *timep, struct tm *result);        
-        localtime_r( &time_now.tv_sec, &time_info);                                      // Convert timespec to tm 
-        
-        // Ref: [22] man page
-        // strftime - formats broken-down time tm according to format spec and stores in char arr
-        // size_t strftime(char s[.max], size_t max, const char *format, const struct tm *tm);
-        strftime(buffer, sizeof(buffer), RFC2822_compliant_strftime_format, &time_info); // Format date and time 
+    if (read(timestamp_timerfd, &expirations, sizeof(expirations)) == RET_FAILURE)
+    {
+        if (errno == ECANCELED && arm_timestamp_timer() == RET_FAILURE)
+            LOG_MSG(LOG_ERR,"Error re-arming timestamp timer; timerfd_settime() failure\n");
+        return;
+    }
 
-        pthread_mutex_lock(&lock);
-        
-        if ((file_ptr = fopen(DATA_FILE, "a+")) == NULL)                                 //opens file in append mode and checks if error
-		{
-        	syslog(LOG_ERR,"Error while opening given file; fopen() failure\n");         //syslog error
-			printf("Error! fopen() failure\n");                                          //prints error
-			pthread_mutex_unlock(&lock);
-			return NULL;
-		}
-        
-        if (fwrite("timestamp:", 1, strlen("timestamp:"), file_ptr) != strlen("timestamp:"))         // Write timestamp string
-        {
-            syslog( LOG_ERR, "Error while writing to given file; fwrite() failure\n" );
-            printf("Error! fwrite() failure\n");                                                     //prints error
-            fclose(file_ptr);
-            pthread_mutex_unlock(&lock);
-            return NULL;
-        }
+    // Ref: [23] man page
+    // clock_gettime(clockid_t clockid, struct timespec *tp);
+    clock_gettime(CLOCK_REALTIME, &time_now);                                        // Get current time with nanosec
 
-        if (fwrite(buffer, 1, strlen(buffer), file_ptr) != strlen(buffer))              // Write timestamp formatted 
-        {
-            syslog( LOG_ERR, "Error while writing to given file; fwrite() failure\n" );
-            printf("Error! fwrite() failure\n");                                       //prints error
-            fclose(file_ptr);
-            pthread_mutex_unlock(&lock);
-            return NULL;
-        }
+    // Ref: [24] man page
+    // struct tm *localtime_r(const time_t *timep, struct tm *result);
+    localtime_r( &time_now.tv_sec, &time_info);                                      // Convert timespec to tm
 
-        fclose(file_ptr);
-        
-        pthread_mutex_unlock(&lock);
-        
-        nanosleep(&time_sleep, NULL);                                                   // sleep for 10 sec; time_sleep timespec struct set to 10 sec
+    // Ref: [22] man page
+    // strftime - formats broken-down time tm according to format spec and stores in char arr
+    // size_t strftime(char s[.max], size_t max, const char *format, const struct tm *tm);
+    len = strftime(buffer, sizeof(buffer), RFC2822_compliant_strftime_format, &time_info); // Format date and time
+
+    lock_data();
+    if (write(data_fd, buffer, len) != (ssize_t)len)
+    {
+        LOG_MSG(LOG_ERR, "Error while writing to given file; write() failure\n");
+        data_len = lseek(data_fd, 0, SEEK_END);                                      // A short write still appended
     }
-    syslog(LOG_INFO,"Success: Timestamp...\n");
-    return NULL;
+    else
+    {
+        data_len += len;
+        history_append(buffer, len);
+    }
+    pthread_mutex_unlock(&lock);
 }
 #endif
+
 /*************************************************************************
  *                       Main Function                                   *
  *************************************************************************/
- 
+
 int main(int argc, char* argv[])
 {
     /*************************************************************************
      *                            Logging                                    *
      *************************************************************************/
-     
+
     // Ref: [2] man page
     // Opens a connection to the system logger for a program
     // openlog(ident, option, facility)
@@ -436,18 +1828,87 @@ int main(int argc, char* argv[])
     printf("Program starting...\n");
 
     /*************************************************************************
-     *                            Daemon mode                                *
-     *************************************************************************/ 
-     
+     *                            Options                                    *
+     *************************************************************************/
+
      // Modify your program to support a -d argument which runs the aesdsocket application as a daemon
+     // -w <count> sets the number of worker threads, defaulting to the number of online cores
+     // -r zerocopy|copy selects how replies are sent, to compare the two paths
+     // -m <bytes> caps the in-memory copy of DATA_FILE used for replies, 0 disables it
+     // -i <seconds> closes connections idle that long, 0 keeps them open; -c <count> caps open connections
+     // -M <port> serves metrics on 127.0.0.1:<port>, 0 disables
      int daemon = 0;
-     if((argc > 1) && (strcmp(argv[1], "-d") == 0))
+     int opt;
+     char *end;
+
+     // Ref: [28] man page
+     // long sysconf(int name);
+     num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+     // Ref: [29] man page
+     // int getopt(int argc, char *argv[], const char *optstring);
+     while ((opt = getopt(argc, argv, "dw:r:m:i:c:M:")) != -1)
      {
-     	daemon = 1; 
-     	syslog(LOG_INFO,"Success: Running in daemon mode...\n"); 
-     	printf("Success: Running in daemon mode...\n");    	
+        switch (opt)
+        {
+            case 'd':
+     	        daemon = 1;
+     	        syslog(LOG_INFO,"Success: Running in daemon mode...\n");
+     	        printf("Success: Running in daemon mode...\n");
+     	        break;
+
+     	    case 'w':
+     	        num_workers = atoi(optarg);
+     	        break;
+
+     	    case 'i':
+     	        idle_timeout = atoi(optarg);
+     	        break;
+
+     	    case 'c':
+     	        max_connections = atoi(optarg);
+     	        break;
+
+     	    case 'M':
+     	        metrics_port = atoi(optarg);
+     	        break;
+
+     	    case 'm':
+     	        // Ref: [35] man page
+     	        errno = 0;
+     	        history_cap = strtoull(optarg, &end, 0);
+     	        if (errno == 0 && end != optarg && *end == '\0')
+     	            break;
+     	        fprintf(stderr, "Invalid cache size: %s\n", optarg);
+     	        closelog();
+     	        exit(FAILURE);
+
+     	    case 'r':
+     	        if (strcmp(optarg, "zerocopy") == 0)
+     	        {
+     	            reply_mode = REPLY_MODE_ZEROCOPY;
+     	            break;
+     	        }
+     	        if (strcmp(optarg, "copy") == 0)
+     	        {
+     	            reply_mode = REPLY_MODE_COPY;
+     	            break;
+     	        }
+     	        // fall through
+
+     	    default:
+     	        fprintf(stderr, "Usage: %s [-d] [-w workers] [-r zerocopy|copy] [-m cache_bytes] [-i idle_seconds] [-c max_connections]"
+     	                " [-M metrics_port]\n", argv[0]);
+     	        closelog();
+     	        exit(FAILURE);
+        }
      }
-    
+
+     if (num_workers < 1)
+        num_workers = 1;
+     if (max_connections < 1)
+        max_connections = 1;
+
     /*************************************************************************
      *                     Signal Handler                                    *
      *************************************************************************/  
@@ -482,8 +1943,6 @@ int main(int argc, char* argv[])
      
     // Ref: [1] beej guide
     struct addrinfo hints, *res;
-    struct sockaddr_in clientaddr;
-    socklen_t clientaddrlen;
     
     // Ref: [4] man page
     /* getaddrinfo()'s hints arg points to addrinfo struct
@@ -538,7 +1997,6 @@ int main(int argc, char* argv[])
     // socket: creates endpoint for communication; returns a fd that refers to that endpoint
     // int socket(int domain, int type, int protocol);
     sockfd = socket(PF_INET, SOCK_STREAM, 0);                           //IPv4, stream, TCP
-    int newfd;                                                          //for client after accepting connection from server
     if (sockfd == RET_FAILURE) 
     {
         syslog(LOG_ERR,"Error creating socket; socket() failure\n");    //syslog error
@@ -621,7 +2079,7 @@ int main(int argc, char* argv[])
     // Ref: [8] man page, [1] beej guide
     // listen - listen for connections on a socket
     // int listen(int sockfd, int backlog);
-    int backlog = 1; // no of connections allowed on the incoming queue (incoming connections are going to wait in this queue until you accept() them; limit on how many can queue up.
+    int backlog = LISTEN_BACKLOG; // no of connections allowed on the incoming queue (incoming connections are going to wait in this queue until you accept() them; limit on how many can queue up.
     rc = listen(sockfd, backlog);
     if (rc == RET_FAILURE)
     {
@@ -633,149 +2091,219 @@ int main(int argc, char* argv[])
     syslog(LOG_INFO,"Success: listen()\n");
     printf("Success: listen()\n");
 
+    // Non-blocking, so the edge-triggered event loop can accept() until EAGAIN
+    // int fcntl(int fd, int cmd, ... /* arg */ );
+    if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error setting socket non-blocking; fcntl() failure\n"); //syslog error
+        printf("Error! fcntl() failure\n"); //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
      /*************************************************************************
       *                          Lock Init                                    *
-      *************************************************************************/ 
-          
+      *************************************************************************/
+
     // int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
     rc = pthread_mutex_init(&lock, NULL);                                            // Initialize a mutex
+    if (rc == SUCCESS)
+        rc = pthread_mutex_init(&conn_lock, NULL);
+    if (rc == SUCCESS)
+        rc = pthread_mutex_init(&work_lock, NULL);
+    if (rc == SUCCESS)
+        rc = pthread_cond_init(&work_cond, NULL);
     if (rc != SUCCESS)                                     // Returns error code on failure
     {
         syslog(LOG_ERR,"Error initializing mutex; pthread_mutex_init() failure\n"); //syslog error
-        printf("Error! pthread_mutex_init() failure\n");                         //prints error 
+        printf("Error! pthread_mutex_init() failure\n");                         //prints error
         closelog();
-        exit(FAILURE);                
+        exit(FAILURE);
     }
-    
+
      /*************************************************************************
-      *                          Timestamp                                   *
-      *************************************************************************/ 
+      *                          Block Signals                                *
+      *************************************************************************/
+
+    // Ref: [31] man page
+    // Threads created below inherit this mask, so SIGINT/SIGTERM are only ever delivered to main while it
+    // waits in epoll_pwait() with orig_mask
+    // int pthread_sigmask(int how, const sigset_t *set, sigset_t *oldset);
+    sigset_t block_mask, orig_mask;
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, SIGINT);
+    sigaddset(&block_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block_mask, &orig_mask);
+
+     /*************************************************************************
+      *                        History Cache                                  *
+      *************************************************************************/
+
+    // Before any thread can append to DATA_FILE
    #ifndef USE_AESD_CHAR_DEVICE
-    pthread_t timestamp_thread;                       // thread_id
-    
-    rc = pthread_create(&timestamp_thread,   // Thread ID
-                        NULL,                          // Default attr
-                        timestamp_handler,           // Handle timestamp
-                        NULL);        // No args
-        
-    if (rc != SUCCESS)                                     // Returns error code on failure
+    if ((data_fd = open(DATA_FILE, O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0744)) == RET_FAILURE)
     {
-        syslog(LOG_ERR,"Error creating thread; pthread_create() failure\n"); //syslog error
-        printf("Error! pthread_create() failure\n");                         //prints error                                          // Free ptr  
+        syslog(LOG_ERR,"Error while opening given file; open() failure\n"); //syslog error
+        printf("Error! open() failure\n");                                 //prints error
         closelog();
-        exit(FAILURE);                
+        exit(FAILURE);
     }
+    data_len = lseek(data_fd, 0, SEEK_END);
     #endif
+    history_init(history_cap);
+
+     /*************************************************************************
+      *                          Worker Pool                                  *
+      *************************************************************************/
 
-    // Restarts accepting connections from new clients forever in a loop until SIGINT or SIGTERM is received
-    
     // For LL
     // Ref: [17] queue.h
-    /*
-	#define	SLIST_INIT(head) do {			    \
-	SLIST_FIRST((head)) = NULL;					\
-    } while (0) */	
-    SLIST_INIT(&head);
-    printf("Entering loop to accept!\n");
-    int debug_count = 0;
-    while(!signal_exit)
+    LIST_INIT(&conn_head);
+    STAILQ_INIT(&work_head);
+
+    // One counter slot for this thread (the event loop) and one per worker
+    metrics = aligned_alloc(CACHE_LINE_SIZE, (num_workers + 1) * sizeof(thread_metrics_t));
+    if (metrics == NULL)
+    {
+        syslog(LOG_ERR,"Error allocating metrics; aligned_alloc() failure\n"); //syslog error
+        printf("Error! aligned_alloc() failure\n");                         //prints error
+        closelog();
+        exit(FAILURE);
+    }
+    memset(metrics, 0, (num_workers + 1) * sizeof(thread_metrics_t));
+    metrics_self = &metrics[0];
+
+    // Request path messages go through the per-thread log rings from here on
+    if (log_init() == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error starting logger thread; pthread_create() failure\n"); //syslog error
+        printf("Error! pthread_create() failure\n");                             //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
+    worker_threads = (pthread_t *) malloc(num_workers * sizeof(pthread_t));
+    if (worker_threads == NULL)
+    {
+        syslog(LOG_ERR,"Error allocating worker pool; malloc() failure\n"); //syslog error
+        printf("Error! malloc() failure\n");                                //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
+    for (int i = 0; i < num_workers; i++)
     {
-      debug_count++;
-      printf("Debug_count = %d\n", debug_count);
-     /*************************************************************************
-      *                    Accept multiple                                    *
-      *************************************************************************/ 
-      
-        //Ref: [9] man page, [1] beej guide
-        // accept - accept a connection on a socket
-        //int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen); 
-        clientaddrlen = sizeof(clientaddr);
-                printf("Before accept\n");
-        newfd =  accept(sockfd, (struct sockaddr *)&clientaddr, &clientaddrlen);
-        if (newfd == RET_FAILURE)
-        {
-            syslog(LOG_ERR,"Error accepting a connection on a socket; accept() failure\n"); //syslog error
-            printf("Error! accept() failure\n"); //prints error
-            closelog();
-            exit(FAILURE);       
-        }
-        syslog(LOG_INFO,"Success: accept()\n");
-        printf("Success: accept()\n");
-        
-        //Logs message to the syslog “Accepted connection from xxx” where XXXX is the IP address of the connected client. 
-        // Ref: [10], [11] man pages
-        // inet_ntoa - Internet network to ASCII; function converts the Internet host address in, given in network byte order, to a string in IPv4 dotted-decimal notation.
-        
-        /*
-           struct sockaddr_in {
-           sa_family_t     sin_family;     // AF_INET
-           in_port_t       sin_port;       // Port number
-           struct in_addr  sin_addr;       // IPv4 address
-           }; 
-        */
-           
-        // Get the IP address as a string
-        ip_address = inet_ntoa(clientaddr.sin_addr);
-        syslog(LOG_USER,"Accepted connection from %s\n", ip_address);
-        printf("Accepted connection from %s\n", ip_address);
-        
-        // Ref: [17] sample.c
-		// Singly Linked List    
-		struct slist_client_s *new_client_node= (struct slist_client_s*) malloc(sizeof(struct slist_client_s)); // Allocate memory for new client node
-		new_client_node->newfd = newfd;                       // Load fd value
-		new_client_node->thread_completion_flag = 0;          // Init complete flag
-		
-		// SLIST_INSERT_HEAD(head, elm, field)
-		SLIST_INSERT_HEAD(&head, new_client_node, entries);   // Insert element at head
-		
 		// Ref: [18] man page
         // pthread_create - create a new thread
         // int pthread_create(pthread_t *thread,
         //                    const pthread_attr_t *attr,
         //                    void *(*start_routine)(void *),
         //                    void *arg);
-        rc = pthread_create(&new_client_node->thread_id,                     // Thread ID
+        rc = pthread_create(&worker_threads[i],                              // Thread ID
                             NULL,                                            // Default attr
-                            multithread_handler,                             // Handle connection made
-                            (void *)new_client_node);                        // Send new client node data as arg
-        
+                            worker_handler,                                  // Services connections from the work queue
+                            &metrics[i + 1]);                                // Counters of this worker
+
         if (rc != SUCCESS)                                                   // Returns error code on failure
         {
             syslog(LOG_ERR,"Error creating thread; pthread_create() failure\n"); //syslog error
             printf("Error! pthread_create() failure\n");                         //prints error
-            
-            // SLIST_REMOVE(head, elm, type, field)
-            SLIST_REMOVE(&head, new_client_node, slist_client_s, entries);  // Remove node from LL if thread creation unsuccessful
-            close(new_client_node->newfd);                                  // Close client connection made
-            free(new_client_node);                                          // Free ptr  
             closelog();
-            exit(FAILURE);                
+            exit(FAILURE);
+        }
+    }
+    syslog(LOG_INFO,"Success: started %d worker threads\n", num_workers);
+    printf("Success: started %d worker threads\n", num_workers);
+
+    // Metrics are optional; a port conflict must not take the data server down with it
+    if (metrics_port > 0 && start_metrics() == RET_FAILURE)
+    {
+        syslog(LOG_WARNING,"Warning: metrics endpoint on port %d not started, errno %d; continuing without it\n",
+               metrics_port, errno);
+        printf("Warning! metrics endpoint on port %d not started; continuing without it\n", metrics_port);
+    }
+
+     /*************************************************************************
+      *                          Event Loop                                   *
+      *************************************************************************/
+
+    // Ref: [25] man page
+    // int epoll_create1(int flags);
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error creating epoll instance; epoll_create1() failure\n"); //syslog error
+        printf("Error! epoll_create1() failure\n");                                 //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
+    // The listening socket is the only entry with a NULL data.ptr
+    struct epoll_event event, events[MAX_EVENTS];
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error adding socket to epoll; epoll_ctl() failure\n"); //syslog error
+        printf("Error! epoll_ctl() failure\n");                                //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
+    if (idle_timeout > 0 && start_idle_timer() == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error starting idle timer; timerfd() failure\n"); //syslog error
+        printf("Error! timerfd() failure\n");                              //prints error
+        closelog();
+        exit(FAILURE);
+    }
+
+   #ifndef USE_AESD_CHAR_DEVICE
+    if (start_timestamp_timer() == RET_FAILURE)
+    {
+        syslog(LOG_ERR,"Error starting timestamp timer; timerfd() failure\n"); //syslog error
+        printf("Error! timerfd() failure\n");                                   //prints error
+        closelog();
+        exit(FAILURE);
+    }
+    #endif
+
+    // Restarts accepting connections from new clients forever in a loop until SIGINT or SIGTERM is received
+    printf("Entering loop to accept!\n");
+    int debug_count = 0;
+    int num_events;
+    while(!signal_exit)
+    {
+      debug_count++;
+      LOG_MSG(LOG_DEBUG, "Debug_count = %d\n", debug_count);
+
+        // Ref: [25] man page
+        // int epoll_pwait(int epfd, struct epoll_event *events, int maxevents, int timeout, const sigset_t *sigmask);
+        num_events = epoll_pwait(epollfd, events, MAX_EVENTS, -1, &orig_mask);
+        if (num_events == RET_FAILURE)
+        {
+            if (errno == EINTR)
+                continue;
+
+            syslog(LOG_ERR,"Error waiting for events; epoll_wait() failure\n"); //syslog error
+            printf("Error! epoll_wait() failure\n"); //prints error
+            break;
         }
-        syslog(LOG_INFO,"Success: pthread_create()\n");
-        printf("Success: pthread_create()\n");
-           
-        SLIST_FOREACH_SAFE(new_client_node, &head, entries, temp)
+
+        for (int i = 0; i < num_events; i++)
         {
-             if (new_client_node->thread_completion_flag)
-             {
-             	 // Ref: [19] man page
-                 // pthread_join - join with a terminated thread
-                 // pthread_join(pthread_t thread, void **retval);
-                 rc = pthread_join(new_client_node->thread_id, NULL);
-                 SLIST_REMOVE(&head, new_client_node, slist_client_s, entries);         // Remove node from LL
-                 free(new_client_node);
-                 if (rc != SUCCESS)   
-                 {
-                     syslog(LOG_ERR,"Error joining thread; pthread_join() failure\n");  //syslog error
-                     printf("Error! pthread_join() failure\n");                         //prints error 
-                   
-                     closelog();
-                     exit(FAILURE);  
-                 }
-             }
-        }  
-        // Logs message to the syslog “Closed connection from XXX” where XXX is the IP address of the connected client.
-        syslog(LOG_USER, "Closed connection from %s\n", ip_address);  
-         printf("Closed connection from %s\n", ip_address);     
+            if (events[i].data.ptr == NULL)
+                accept_connections();                                  // New clients on sockfd
+            else if (events[i].data.ptr == &idle_timerfd)
+                expire_idle_connections();                             // Periodic idle check
+            #ifndef USE_AESD_CHAR_DEVICE
+            else if (events[i].data.ptr == &timestamp_timerfd)
+                write_timestamp();                                     // Timestamp deadline
+            #endif
+            else
+                queue_connection(events[i].data.ptr);                  // Data ready on a client connection
+        }
     }
+
+    cleanup();
 }
@@ -0,0 +1,82 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#define ENTRIES_TO_ADD (3 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+
+static char lines[ENTRIES_TO_ADD][16];
+
+/**
+ * Adds "evict<n>\n" to buffer
+ * @return what aesd_circular_buffer_add_entry() returned
+ */
+static const char *add_line(struct aesd_circular_buffer *buffer, int n)
+{
+    struct aesd_buffer_entry entry;
+
+    snprintf(lines[n], sizeof(lines[n]), "evict%d\n", n);
+    entry.buffptr = lines[n];
+    entry.size = strlen(lines[n]);
+    return aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+/**
+ * Adding to a full buffer returns the buffptr of the entry it overwrote, the oldest one, so the caller can free
+ * it. The entry that becomes the oldest is still stored and must not be handed back.
+ */
+static void verify_add_returns_overwritten(struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    struct aesd_buffer_entry *oldest;
+    size_t entry_offset;
+    int n;
+
+    for (n = 0; n < (int)capacity; n++)
+        TEST_ASSERT_NULL_MESSAGE(add_line(buffer, n), "add_entry returned a buffer while not full");
+
+    for (; n < ENTRIES_TO_ADD; n++)
+    {
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(lines[n - capacity], add_line(buffer, n),
+                                      "add_entry did not return the overwritten oldest entry");
+        oldest = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, 0, &entry_offset);
+        TEST_ASSERT_NOT_NULL(oldest);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(lines[n - capacity + 1], oldest->buffptr,
+                                      "the new oldest entry is not the one after the overwritten one");
+        TEST_ASSERT_EQUAL_size_t(0, entry_offset);
+    }
+}
+
+void test_circular_buffer_add_returns_overwritten_entry()
+{
+    struct aesd_circular_buffer buffer;
+
+    aesd_circular_buffer_init(&buffer);
+    verify_add_returns_overwritten(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+}
+
+void test_circular_buffer_add_returns_overwritten_entry_custom_capacity()
+{
+    struct aesd_buffer_entry storage[3];
+    struct aesd_circular_buffer buffer;
+
+    memset(storage, 0, sizeof(storage));
+    aesd_circular_buffer_init_storage(&buffer, storage, 3);
+    verify_add_returns_overwritten(&buffer, 3);
+}
+
+void test_circular_buffer_remove_oldest_returns_oldest()
+{
+    struct aesd_circular_buffer buffer;
+    int n;
+
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_NULL(aesd_circular_buffer_remove_oldest(&buffer));
+    for (n = 0; n < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; n++)
+        add_line(&buffer, n);
+    TEST_ASSERT_EQUAL_PTR(lines[2], aesd_circular_buffer_remove_oldest(&buffer));
+    TEST_ASSERT_EQUAL_PTR(lines[3], aesd_circular_buffer_remove_oldest(&buffer));
+    TEST_ASSERT_EQUAL_size_t(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 2, aesd_circular_buffer_count(&buffer));
+    // With room again, adding does not overwrite anything
+    TEST_ASSERT_NULL(add_line(&buffer, n));
+}
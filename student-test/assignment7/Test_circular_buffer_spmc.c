@@ -0,0 +1,268 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "../../aesd-char-driver/aesd-circular-buffer-spmc.h"
+
+#define WRITE_ENTRIES 10
+
+/**
+ * Adds "write1\n" ... "write<count>\n", numbered from first_number, to ring
+ */
+static void write_entries(struct aesd_spmc_ring *ring, int first_number, int count)
+{
+    char line[32];
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        snprintf(line, sizeof(line), "write%d\n", first_number + i);
+        TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_add_entry(ring, line, strlen(line)));
+    }
+}
+
+/**
+ * Verifies every byte offset of the ring maps to the expected entry and offset, for entries
+ * "write<first_number>\n" ... "write<last_number>\n"
+ */
+static void verify_entries(struct aesd_spmc_ring *ring, int first_number, int last_number)
+{
+    char expected[32], actual[32];
+    size_t char_offset = 0, entry_offset, size;
+    uint64_t entry_number, start, first_entry;
+    struct aesd_spmc_view view;
+    int number;
+
+    TEST_ASSERT_TRUE(aesd_spmc_ring_snapshot(ring, &view));
+    first_entry = view.first;
+    for (number = first_number; number <= last_number; number++)
+    {
+        snprintf(expected, sizeof(expected), "write%d\n", number);
+        for (size_t i = 0; i < strlen(expected); i++, char_offset++)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(aesd_spmc_ring_find_entry_offset_for_fpos(ring, char_offset,
+                                     &entry_number, &entry_offset), "offset within the stored data not found");
+            TEST_ASSERT_EQUAL_UINT64(first_entry + (number - first_number), entry_number);
+            TEST_ASSERT_EQUAL_size_t(i, entry_offset);
+        }
+
+        TEST_ASSERT_TRUE(aesd_spmc_ring_get_entry(ring, first_entry + (number - first_number), &start, &size));
+        TEST_ASSERT_EQUAL_size_t(strlen(expected), size);
+        TEST_ASSERT_EQUAL_INT((ssize_t)size, aesd_spmc_ring_read(ring, start, actual, size));
+        TEST_ASSERT_EQUAL_MEMORY(expected, actual, size);
+    }
+    TEST_ASSERT_FALSE_MESSAGE(aesd_spmc_ring_find_entry_offset_for_fpos(ring, char_offset, &entry_number,
+                              &entry_offset), "offset past the end of the stored data found");
+}
+
+void test_spmc_ring_empty()
+{
+    struct aesd_spmc_ring ring;
+    struct aesd_spmc_view view;
+    uint64_t entry_number;
+    size_t entry_offset;
+    char byte;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 1024));
+    TEST_ASSERT_FALSE(aesd_spmc_ring_snapshot(&ring, &view));
+    TEST_ASSERT_FALSE(aesd_spmc_ring_find_entry_offset_for_fpos(&ring, 0, &entry_number, &entry_offset));
+    TEST_ASSERT_FALSE(aesd_spmc_ring_get_entry(&ring, 0, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_read(&ring, 0, &byte, 1));
+    aesd_spmc_ring_destroy(&ring);
+
+    TEST_ASSERT_EQUAL_INT(-1, aesd_spmc_ring_init(&ring, 0, 1024));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 0));
+}
+
+void test_spmc_ring_find_entries()
+{
+    struct aesd_spmc_ring ring;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 1024));
+    write_entries(&ring, 1, WRITE_ENTRIES);
+    verify_entries(&ring, 1, WRITE_ENTRIES);
+    aesd_spmc_ring_destroy(&ring);
+}
+
+void test_spmc_ring_overwrite()
+{
+    struct aesd_spmc_ring ring;
+    struct aesd_spmc_view view;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 1024));
+    write_entries(&ring, 1, WRITE_ENTRIES);
+
+    // The 11th write replaces the oldest entry
+    write_entries(&ring, WRITE_ENTRIES + 1, 1);
+    TEST_ASSERT_TRUE(aesd_spmc_ring_snapshot(&ring, &view));
+    TEST_ASSERT_EQUAL_UINT64(1, view.first);
+    TEST_ASSERT_EQUAL_UINT64(WRITE_ENTRIES, view.count);
+    TEST_ASSERT_FALSE(aesd_spmc_ring_get_entry(&ring, 0, NULL, NULL));
+    verify_entries(&ring, 2, WRITE_ENTRIES + 1);
+
+    // Wrap all the way around
+    write_entries(&ring, WRITE_ENTRIES + 2, WRITE_ENTRIES + 5);
+    verify_entries(&ring, WRITE_ENTRIES + 7, 2 * WRITE_ENTRIES + 6);
+    aesd_spmc_ring_destroy(&ring);
+}
+
+void test_spmc_ring_byte_limit()
+{
+    struct aesd_spmc_ring ring;
+    struct aesd_spmc_view view;
+    char big[17];
+    char actual[8];
+
+    // "writeN\n" is 7 bytes; a 16 byte arena holds two of them
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 16));
+    write_entries(&ring, 1, 3);
+    TEST_ASSERT_TRUE(aesd_spmc_ring_snapshot(&ring, &view));
+    TEST_ASSERT_EQUAL_UINT64(2, view.count);
+    verify_entries(&ring, 2, 3);
+
+    // Data of a dropped entry can no longer be read
+    TEST_ASSERT_EQUAL_INT(-1, aesd_spmc_ring_read(&ring, 0, actual, sizeof(actual)));
+
+    // Entries larger than the arena are refused and leave the ring alone
+    memset(big, 'x', sizeof(big));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_spmc_ring_add_entry(&ring, big, sizeof(big)));
+    verify_entries(&ring, 2, 3);
+    aesd_spmc_ring_destroy(&ring);
+}
+
+void test_spmc_ring_read_across_entries()
+{
+    struct aesd_spmc_ring ring;
+    struct aesd_spmc_view view;
+    char expected[256] = "", actual[256], line[32];
+    int i;
+
+    // Small arena so the stored data wraps around its end
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&ring, WRITE_ENTRIES, 50));
+    write_entries(&ring, 1, 12);
+    TEST_ASSERT_TRUE(aesd_spmc_ring_snapshot(&ring, &view));
+    for (i = 13 - view.count; i <= 12; i++)
+    {
+        snprintf(line, sizeof(line), "write%d\n", i);
+        strcat(expected, line);
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(strlen(expected), view.end - view.start);
+    TEST_ASSERT_EQUAL_INT(strlen(expected), aesd_spmc_ring_read(&ring, view.start, actual, sizeof(actual)));
+    TEST_ASSERT_EQUAL_MEMORY(expected, actual, strlen(expected));
+
+    // Partial reads from the middle, and the end of the data
+    TEST_ASSERT_EQUAL_INT(5, aesd_spmc_ring_read(&ring, view.start + 3, actual, 5));
+    TEST_ASSERT_EQUAL_MEMORY(expected + 3, actual, 5);
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_read(&ring, view.end, actual, sizeof(actual)));
+    aesd_spmc_ring_destroy(&ring);
+}
+
+/*
+ * Stress: one producer adds entries whose contents are derived from their number while consumers read
+ * random and sequential entries.  Every read that the ring reports as successful must be intact.
+ */
+#define STRESS_ENTRIES     200000
+#define STRESS_CONSUMERS   4
+
+struct stress_state
+{
+    struct aesd_spmc_ring ring;
+    atomic_bool done;
+    atomic_ulong verified;
+    atomic_ulong corrupt;
+};
+
+static size_t stress_line(uint64_t number, char *line)
+{
+    // Lengths vary with the number so entries wrap the arena at every possible offset
+    int len = sprintf(line, "%llu:", (unsigned long long)number);
+    int pad = number % 37;
+
+    memset(line + len, 'a' + number % 26, pad);
+    line[len + pad] = '\n';
+    return len + pad + 1;
+}
+
+static void *stress_producer(void *arg)
+{
+    struct stress_state *state = arg;
+    char line[64];
+    uint64_t number;
+
+    for (number = 0; number < STRESS_ENTRIES; number++)
+        aesd_spmc_ring_add_entry(&state->ring, line, stress_line(number, line));
+    atomic_store(&state->done, true);
+    return NULL;
+}
+
+static void *stress_consumer(void *arg)
+{
+    struct stress_state *state = arg;
+    struct aesd_spmc_view view;
+    char expected[64], actual[64];
+    uint64_t number, start;
+    size_t size, entry_offset;
+    unsigned int seed = (unsigned int)(uintptr_t)&view;
+
+    while (!atomic_load(&state->done))
+    {
+        if (!aesd_spmc_ring_snapshot(&state->ring, &view))
+            continue;
+
+        // A random stored entry, through its number
+        number = view.first + rand_r(&seed) % view.count;
+        if (aesd_spmc_ring_get_entry(&state->ring, number, &start, &size) &&
+            aesd_spmc_ring_read(&state->ring, start, actual, size) == (ssize_t)size)
+        {
+            if (size == stress_line(number, expected) && memcmp(expected, actual, size) == 0)
+                atomic_fetch_add(&state->verified, 1);
+            else
+                atomic_fetch_add(&state->corrupt, 1);
+        }
+
+        // The oldest byte, through a char offset
+        if (aesd_spmc_ring_find_entry_offset_for_fpos(&state->ring, 0, &number, &entry_offset) &&
+            aesd_spmc_ring_get_entry(&state->ring, number, &start, &size) &&
+            aesd_spmc_ring_read(&state->ring, start, actual, size) == (ssize_t)size)
+        {
+            if (size == stress_line(number, expected) && memcmp(expected, actual, size) == 0)
+                atomic_fetch_add(&state->verified, 1);
+            else
+                atomic_fetch_add(&state->corrupt, 1);
+        }
+    }
+    return NULL;
+}
+
+void test_spmc_ring_stress()
+{
+    static struct stress_state state;
+    pthread_t producer, consumers[STRESS_CONSUMERS];
+    int i;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_spmc_ring_init(&state.ring, 64, 1024));
+    atomic_init(&state.done, false);
+    atomic_init(&state.verified, 0);
+    atomic_init(&state.corrupt, 0);
+
+    for (i = 0; i < STRESS_CONSUMERS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&consumers[i], NULL, stress_consumer, &state));
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&producer, NULL, stress_producer, &state));
+
+    pthread_join(producer, NULL);
+    for (i = 0; i < STRESS_CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+
+    TEST_ASSERT_EQUAL_UINT64(0, atomic_load(&state.corrupt));
+    TEST_ASSERT_TRUE_MESSAGE(atomic_load(&state.verified) > 0, "consumers never completed a read");
+
+    // After the producer stops, the newest entries are all intact
+    struct aesd_spmc_view view;
+    TEST_ASSERT_TRUE(aesd_spmc_ring_snapshot(&state.ring, &view));
+    TEST_ASSERT_EQUAL_UINT64(STRESS_ENTRIES, view.first + view.count);
+    aesd_spmc_ring_destroy(&state.ring);
+}
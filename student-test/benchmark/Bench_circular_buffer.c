@@ -0,0 +1,163 @@
+/**
+ * @file Bench_circular_buffer.c
+ * @brief User space micro-benchmark for aesd-circular-buffer
+ *
+ * Times aesd_circular_buffer_add_entry() and aesd_circular_buffer_find_entry_offset_for_fpos() for a range of
+ * entry counts and entry sizes, on a full buffer as the driver sees it in steady state:
+ *   add        add_entry on a full buffer, overwriting the oldest entry
+ *   evict_add  remove_oldest then add_entry, the driver's write path
+ *   find       lookups at char offsets that are sequential (every entry in order), random, or tail (within the
+ *              newest entry, as a reader following the writer does)
+ *
+ * Prints one CSV row per case on stdout: op,pattern,entries,entry_size,iterations,ns_per_op
+ * Usage: circular-buffer-bench [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS 1000000
+#define OFFSET_TABLE_SIZE  4096            // Pregenerated offsets, so the random generator is not timed
+
+static const unsigned int entry_counts[] = { 10, 64, 1024, 65536 };
+static const size_t entry_sizes[] = { 16, 256, 4096 };
+
+// Keeps the compiler from dropping the lookups whose results are otherwise unused
+static volatile uintptr_t sink;
+
+static char data[4096];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sets up @param buffer with @param capacity entries of @param size bytes each, all slots in use
+ * @return the entry storage, to be freed by the caller
+ */
+static struct aesd_buffer_entry *fill_buffer(struct aesd_circular_buffer *buffer, unsigned int capacity,
+            size_t size)
+{
+    struct aesd_buffer_entry *storage = calloc(capacity, sizeof(*storage));
+    struct aesd_buffer_entry entry = { .buffptr = data, .size = size };
+    unsigned int i;
+
+    if (storage == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    aesd_circular_buffer_init_storage(buffer, storage, capacity);
+    // Wrap around once, so out_offs is not at 0 and lookups cross the end of the entry array
+    for (i = 0; i < capacity + capacity / 2; i++)
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    return storage;
+}
+
+static void report(const char *op, const char *pattern, unsigned int capacity, size_t size,
+            unsigned long iterations, uint64_t elapsed_ns)
+{
+    printf("%s,%s,%u,%zu,%lu,%.2f\n", op, pattern, capacity, size, iterations,
+           (double)elapsed_ns / iterations);
+}
+
+static void bench_add(unsigned int capacity, size_t size, unsigned long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = { .buffptr = data, .size = size };
+    struct aesd_buffer_entry *storage = fill_buffer(&buffer, capacity, size);
+    uint64_t start;
+    unsigned long i;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+        sink = (uintptr_t)aesd_circular_buffer_add_entry(&buffer, &entry);
+    report("add", "-", capacity, size, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        sink = (uintptr_t)aesd_circular_buffer_remove_oldest(&buffer);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    report("evict_add", "-", capacity, size, iterations, now_ns() - start);
+    free(storage);
+}
+
+static void bench_find(unsigned int capacity, size_t size, unsigned long iterations)
+{
+    static const char *patterns[] = { "sequential", "random", "tail" };
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *storage = fill_buffer(&buffer, capacity, size);
+    size_t total = aesd_circular_buffer_size(&buffer);
+    size_t offsets[OFFSET_TABLE_SIZE];
+    size_t entry_offset;
+    unsigned int seed = 1;
+    uint64_t start;
+    unsigned long i;
+    int p, j;
+
+    for (p = 0; p < 3; p++)
+    {
+        for (j = 0; j < OFFSET_TABLE_SIZE; j++)
+        {
+            if (p == 0)
+                offsets[j] = ((uint64_t)j * total / OFFSET_TABLE_SIZE + size / 2) % total;
+            else if (p == 1)
+                offsets[j] = (((uint64_t)rand_r(&seed) << 16) ^ rand_r(&seed)) % total;
+            else
+                offsets[j] = total - size + rand_r(&seed) % size;
+        }
+
+        start = now_ns();
+        for (i = 0; i < iterations; i++)
+            sink = (uintptr_t)aesd_circular_buffer_find_entry_offset_for_fpos(&buffer,
+                        offsets[i % OFFSET_TABLE_SIZE], &entry_offset);
+        report("find", patterns[p], capacity, size, iterations, now_ns() - start);
+    }
+    free(storage);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    size_t c, s;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n')
+            iterations = strtoul(optarg, NULL, 10);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0)
+    {
+        fprintf(stderr, "iterations must be positive\n");
+        return 1;
+    }
+
+    memset(data, 'x', sizeof(data));
+    printf("op,pattern,entries,entry_size,iterations,ns_per_op\n");
+    for (c = 0; c < sizeof(entry_counts) / sizeof(entry_counts[0]); c++)
+    {
+        for (s = 0; s < sizeof(entry_sizes) / sizeof(entry_sizes[0]); s++)
+        {
+            bench_add(entry_counts[c], entry_sizes[s], iterations);
+            bench_find(entry_counts[c], entry_sizes[s], iterations);
+        }
+    }
+    return 0;
+}